@@ -0,0 +1,363 @@
+//
+// micro-benchmarks of the thread library: voluntary and preemptive switches, spawn/terminate, block/resume and
+// sleep wakeups, each with 10 up to 100K threads. every operation is timed on its own with CLOCK_MONOTONIC and the
+// samples are printed as percentiles, in nanoseconds, so runs of different versions can be compared. a ping-pong
+// between two threads, through a global with block/resume and through channels, ends the run.
+//
+// usage: ./bench [max_threads] [quantum_usecs]
+//
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <vector>
+#include "uthreads.h"
+#include "channel.h"
+
+#define DEFAULT_MAX_THREADS 100000
+#define DEFAULT_QUANTUM_USECS 1000
+#define MAX_SAMPLES 200000 // samples taken by a benchmark at most, per thread count
+#define PREEMPT_SAMPLES 1000 // preemptions timed per thread count, one per quantum
+#define PINGPONG_SAMPLES 100000 // round trips of a ping-pong, short enough to run within one slice
+#define SLEEP_MIN_USECS 1000 // the sleep benchmark sleeps between SLEEP_MIN_USECS and twice as long
+#define TID_BITS 20 // the low bits of a stamp of the preemption benchmark hold the tid of the thread that took it
+
+static long samples[MAX_SAMPLES];
+static int sample_slots; // slots handed out in the current run, may pass target_samples
+static volatile bool done = false;
+static volatile long last_stamp; // when the last thread switched away from its last yield
+static long last_spin; // the last time stamp of the preemption benchmark, shifted by TID_BITS, and the tid
+static long epoch; // start of the run, the time stamps of the preemption benchmark are taken from it
+static int target_samples;
+static int rounds; // operations per thread
+static volatile long mailbox; // the message of the block/resume ping-pong, -1 ends it
+static int pinger_tid;
+static int ponger_tid;
+static Channel<long>* pings;
+static Channel<long>* pongs;
+
+/**
+ * @return CLOCK_MONOTONIC in nanoseconds
+ */
+static long now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/**
+ * the threads that take samples may be preempted anywhere, so every sample claims its slot with one atomic add
+ */
+static void sample(long ns){
+    int slot = __atomic_fetch_add(&sample_slots, 1, __ATOMIC_RELAXED);
+    if(slot < target_samples){
+        samples[slot] = ns;
+    }else{
+        done = true;
+    }
+}
+
+/**
+ * @return the number of samples taken in the current run
+ */
+static int sample_count(){
+    return std::min(sample_slots, target_samples);
+}
+
+static long percentile(int count, double p){
+    int index = (int) (p * (count - 1));
+    return samples[index];
+}
+
+/**
+ * prints the mean and the percentiles of the samples, and clears them for the next run
+ */
+static void report(const char* name, int threads){
+    int count = sample_count();
+    if(count == 0){
+        printf("%-18s %8d %8d\n", name, threads, 0);
+        return;
+    }
+    std::sort(samples, samples + count);
+    long sum = 0;
+    for(int i = 0; i < count; i++){
+        sum += samples[i];
+    }
+    printf("%-18s %8d %8d %9ld %9ld %9ld %9ld %9ld %9ld\n", name, threads, count, sum / count,
+           percentile(count, 0.5), percentile(count, 0.9), percentile(count, 0.99), percentile(count, 0.999),
+           samples[count - 1]);
+    fflush(stdout);
+    sample_slots = 0;
+}
+
+/**
+ * starts a run that keeps up to max samples
+ */
+static void start_run(int max){
+    sample_slots = 0;
+    target_samples = std::min(max, MAX_SAMPLES);
+    done = false;
+    epoch = now();
+    last_stamp = epoch;
+    last_spin = -1;
+}
+
+/**
+ * creates count threads that run routine, and waits for all of them to finish.
+ * the main thread creates them with the highest priority, so none of them runs before all are there.
+ */
+static void run_threads(int count, uthread_start_routine routine){
+    std::vector<int> tids(count);
+    uthread_set_priority(0, 0);
+    for(int i = 0; i < count; i ++){
+        tids[i] = uthread_create(routine, nullptr);
+        if(tids[i] == -1){
+            fprintf(stderr, "bench: uthread_create failed after %d threads\n", i);
+            exit(1);
+        }
+    }
+    uthread_set_priority(0, UTHREAD_DEFAULT_PRIORITY);
+    for(int tid : tids){
+        uthread_join(tid, nullptr);
+    }
+}
+
+/**
+ * every yield is timed from the moment the yielding thread calls it until the next thread returns from its own
+ */
+static void* yielder(void*){
+    for(int i = 0; i < rounds && !done; i ++){
+        last_stamp = now();
+        uthread_yield();
+        sample(now() - last_stamp);
+    }
+    return nullptr;
+}
+
+static void bench_yield(int threads){
+    start_run(MAX_SAMPLES);
+    rounds = std::max(2, MAX_SAMPLES / threads + 1);
+    run_threads(threads, &yielder);
+    report("voluntary switch", threads);
+}
+
+/**
+ * spins, publishing a time stamp on every turn. the first stamp a thread takes after another thread ran times the
+ * preemption: the timer signal, timer_handler and the switch. the stamp and the tid are swapped in with one atomic
+ * exchange, and a thread that finds a later stamp than its own was preempted between taking and publishing it, so
+ * that switch is not timed.
+ */
+static void* spinner(void*){
+    long tid = uthread_get_tid();
+    while(!done){
+        long stamp = now() - epoch;
+        long prev = __atomic_exchange_n(&last_spin, (stamp << TID_BITS) | tid, __ATOMIC_RELAXED);
+        if(prev == -1 || (prev & ((1L << TID_BITS) - 1)) == tid){
+            continue;
+        }
+        long prev_stamp = prev >> TID_BITS;
+        if(prev_stamp <= stamp){
+            sample(stamp - prev_stamp);
+        }
+    }
+    return nullptr;
+}
+
+static void bench_preempt(int threads){
+    start_run(PREEMPT_SAMPLES);
+    run_threads(threads, &spinner);
+    report("preemptive switch", threads);
+}
+
+static void parked(){
+    uthread_block(uthread_get_tid());
+}
+
+/**
+ * spawns and terminates a thread that never runs, next to threads - 1 blocked threads
+ */
+static void bench_spawn(int threads){
+    std::vector<int> population;
+    for(int i = 1; i < threads; i ++){
+        population.push_back(uthread_spawn(&parked));
+    }
+    uthread_yield(); // let them block
+    start_run(MAX_SAMPLES);
+    while(!done){
+        long start = now();
+        int tid = uthread_spawn(&parked);
+        uthread_terminate(tid);
+        sample(now() - start);
+    }
+    report("spawn/terminate", threads);
+    for(int tid : population){
+        uthread_terminate(tid);
+    }
+}
+
+static void* blocker(void*){
+    while(!done){
+        uthread_block(uthread_get_tid());
+    }
+    return nullptr;
+}
+
+/**
+ * the main thread resumes one of threads blocked threads and yields to it, and the thread blocks itself again, which
+ * switches back: two switches, a resume and a block per sample
+ */
+static void bench_block(int threads){
+    start_run(MAX_SAMPLES);
+    std::vector<int> tids(threads);
+    for(int i = 0; i < threads; i ++){
+        tids[i] = uthread_create(&blocker, nullptr);
+    }
+    uthread_yield(); // all of them block
+    for(int i = 0; !done; i = (i + 1) % threads){
+        long start = now();
+        uthread_resume(tids[i]);
+        uthread_yield();
+        sample(now() - start);
+    }
+    for(int tid : tids){
+        uthread_resume(tid);
+        uthread_join(tid, nullptr);
+    }
+    report("block/resume", threads);
+}
+
+/**
+ * sleeps with uthread_sleep_us, and times how late the thread runs again after its deadline.
+ * the sleeps are drawn with xorshift and not rand, whose lock would be held across a preemption.
+ */
+static void* sleeper(void*){
+    unsigned seed = (unsigned) uthread_get_tid() * 2654435761U + 1;
+    for(int i = 0; i < rounds && !done; i ++){
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        long usecs = SLEEP_MIN_USECS + seed % SLEEP_MIN_USECS;
+        long deadline = now() + usecs * 1000;
+        uthread_sleep_us(usecs);
+        sample(now() - deadline);
+    }
+    return nullptr;
+}
+
+static void bench_sleep(int threads){
+    start_run(MAX_SAMPLES / 4);
+    rounds = std::max(1, MAX_SAMPLES / 4 / threads);
+    run_threads(threads, &sleeper);
+    report("sleep wakeup late", threads);
+}
+
+/**
+ * the pattern of main.cpp: the message goes through a global, and the threads wake each other with uthread_resume
+ * and wait with uthread_block
+ */
+static void* block_ponger(void*){
+    while(true){
+        uthread_block(uthread_get_tid());
+        if(mailbox < 0){
+            return nullptr;
+        }
+        mailbox += 1;
+        uthread_resume(pinger_tid);
+    }
+}
+
+/**
+ * every sample is a round trip, two messages
+ */
+static void* block_pinger(void*){
+    for(long i = 0; !done; i += 2){
+        long start = now();
+        mailbox = i;
+        uthread_resume(ponger_tid);
+        uthread_block(uthread_get_tid());
+        sample(now() - start);
+    }
+    mailbox = -1;
+    uthread_resume(ponger_tid);
+    return nullptr;
+}
+
+static void* chan_ponger(void*){
+    long msg;
+    while(pings->recv(msg) == 0 && msg >= 0){
+        msg += 1;
+        pongs->send(msg);
+    }
+    return nullptr;
+}
+
+static void* chan_pinger(void*){
+    for(long i = 0; !done; i += 2){
+        long start = now();
+        long msg = i;
+        pings->send(msg);
+        pongs->recv(msg);
+        sample(now() - start);
+    }
+    long stop = -1;
+    pings->send(stop);
+    return nullptr;
+}
+
+/**
+ * the ponger starts first and waits for the first message. both threads take the longest slice, so the timer does
+ * not preempt the block/resume pinger between resuming the ponger and blocking itself, which would lose the wakeup.
+ * @return messages per second
+ */
+static long ping_pong(const char* name, uthread_start_routine pinger, uthread_start_routine ponger){
+    start_run(PINGPONG_SAMPLES);
+    long start = now();
+    ponger_tid = uthread_create(ponger, nullptr);
+    uthread_set_slice(ponger_tid, UTHREAD_MAX_SLICE);
+    uthread_yield();
+    pinger_tid = uthread_create(pinger, nullptr);
+    uthread_set_slice(pinger_tid, UTHREAD_MAX_SLICE);
+    uthread_join(pinger_tid, nullptr);
+    uthread_join(ponger_tid, nullptr);
+    long messages = 2 * (long) sample_count();
+    long rate = messages * 1000000000L / (now() - start);
+    report(name, 2);
+    return rate;
+}
+
+int main(int argc, char** argv){
+    int max_threads = argc > 1 ? atoi(argv[1]) : DEFAULT_MAX_THREADS;
+    int quantum_usecs = argc > 2 ? atoi(argv[2]) : DEFAULT_QUANTUM_USECS;
+    if(max_threads < 10 || quantum_usecs <= 0){
+        fprintf(stderr, "usage: %s [max_threads >= 10] [quantum_usecs > 0]\n", argv[0]);
+        return 1;
+    }
+    uthread_config config = {0};
+    config.quantum_usecs = quantum_usecs;
+    config.max_threads = max_threads + 2;
+    config.clock = UTHREAD_CLOCK_MONOTONIC;
+    config.timer_slack_ns = 1;
+    if(uthread_init_ex(&config) == -1){
+        return 1;
+    }
+    printf("quantum %d us, times in ns\n", quantum_usecs);
+    printf("%-18s %8s %8s %9s %9s %9s %9s %9s %9s\n", "benchmark", "threads", "samples", "mean", "p50", "p90",
+           "p99", "p99.9", "max");
+    for(int threads = 10; threads <= max_threads; threads *= 10){
+        bench_yield(threads);
+        bench_preempt(threads);
+        bench_spawn(threads);
+        bench_block(threads);
+        bench_sleep(threads);
+    }
+    pings = new Channel<long>(1);
+    pongs = new Channel<long>(1);
+    long blocking = ping_pong("ping-pong blk/res", &block_pinger, &block_ponger);
+    long channel = ping_pong("ping-pong channel", &chan_pinger, &chan_ponger);
+    printf("ping-pong messages/s: block/resume %ld, channel %ld\n", blocking, channel);
+    delete pings;
+    delete pongs;
+    uthread_terminate(0);
+    return 0;
+}
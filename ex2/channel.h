@@ -0,0 +1,63 @@
+#ifndef UTHREADS_CHANNEL_H
+#define UTHREADS_CHANNEL_H
+
+#include <type_traits>
+#include "uthreads.h"
+
+/**
+ * bounded channel of T messages between threads, a typed uthread_chan_t.
+ * the messages are copied byte by byte, straight into a waiting receiver when there is one, so T must be trivially
+ * copyable. the channel must be destroyed while the library runs, and with no thread waiting on it.
+ */
+template <typename T>
+class Channel{
+    static_assert(std::is_trivially_copyable<T>::value, "messages are copied with memcpy");
+
+    uthread_chan_t chan;
+    bool valid;
+public :
+    /**
+     * @param capacity messages the channel holds, 0 for a channel where every send waits for its receiver
+     */
+    explicit Channel(int capacity)
+    {
+        valid = uthread_chan_init(&chan, capacity, sizeof(T)) == 0;
+    }
+
+    Channel(const Channel&) = delete;
+
+    Channel& operator=(const Channel&) = delete;
+
+    ~Channel()
+    {
+        if(valid){
+            uthread_chan_destroy(&chan);
+        }
+    }
+
+    /**
+     * @return false if the channel could not be set up, then sending and receiving fail
+     */
+    bool ok() const
+    {
+        return valid;
+    }
+
+    /**
+     * @return 0 on success, -1 otherwise, see uthread_chan_send
+     */
+    int send(const T& msg)
+    {
+        return valid ? uthread_chan_send(&chan, &msg) : -1;
+    }
+
+    /**
+     * @return 0 on success, -1 otherwise, see uthread_chan_recv
+     */
+    int recv(T& msg)
+    {
+        return valid ? uthread_chan_recv(&chan, &msg) : -1;
+    }
+};
+
+#endif //UTHREADS_CHANNEL_H
@@ -0,0 +1,103 @@
+#ifndef UTHREADS_CHUNKED_ARRAY_H
+#define UTHREADS_CHUNKED_ARRAY_H
+
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#define CHUNK_SHIFT 6
+#define CHUNK_SIZE (1 << CHUNK_SHIFT)
+
+/**
+ * array indexed by tid that grows a chunk of CHUNK_SIZE entries at a time.
+ * chunks are never moved once allocated, so pointers to entries stay valid while the array grows, and a process
+ * with a few threads only pays for the chunks it touched. the chunks are allocated at the alignment of T, which new
+ * does not honor for over-aligned types before C++17.
+ */
+template <typename T>
+class ChunkedArray{
+    std::vector<T*> chunks;
+
+    static T* new_chunk()
+    {
+        void* memory;
+        size_t alignment = alignof(T) > sizeof(void*) ? alignof(T) : sizeof(void*);
+        if(posix_memalign(&memory, alignment, CHUNK_SIZE * sizeof(T)) != 0){
+            return nullptr;
+        }
+        T* chunk = (T*) memory;
+        for(int i = 0; i < CHUNK_SIZE; i++){
+            new (&chunk[i]) T();
+        }
+        return chunk;
+    }
+
+    static void delete_chunk(T* chunk)
+    {
+        for(int i = 0; i < CHUNK_SIZE; i++){
+            chunk[i].~T();
+        }
+        free(chunk);
+    }
+public :
+    ChunkedArray() = default;
+
+    ChunkedArray(const ChunkedArray&) = delete;
+
+    ChunkedArray& operator=(const ChunkedArray&) = delete;
+
+    ~ChunkedArray()
+    {
+        for(T* chunk : chunks){
+            if(chunk){
+                delete_chunk(chunk);
+            }
+        }
+    }
+
+    /**
+     * makes room for the chunks of size entries, so the chunk directory is never moved while it grows up to size.
+     * a worker that reads an entry without the library lock can then not see the directory being reallocated.
+     * @param size
+     */
+    void reserve(int size)
+    {
+        chunks.reserve((size + CHUNK_SIZE - 1) >> CHUNK_SHIFT);
+    }
+
+    /**
+     * allocates the chunk that holds index if it is not there yet
+     * @param index
+     * @return 0 on success, -1 if allocation failed
+     */
+    int ensure(int index)
+    {
+        size_t chunk = index >> CHUNK_SHIFT;
+        if(chunk >= chunks.size()){
+            chunks.resize(chunk + 1, nullptr);
+        }
+        if(!chunks[chunk]){
+            chunks[chunk] = new_chunk();
+        }
+        return chunks[chunk] ? 0 : -1;
+    }
+
+    /**
+     * @return the entry at index, nullptr if its chunk was never allocated
+     */
+    T* find(int index) const
+    {
+        size_t chunk = index >> CHUNK_SHIFT;
+        if(index < 0 || chunk >= chunks.size() || !chunks[chunk]){
+            return nullptr;
+        }
+        return &chunks[chunk][index & (CHUNK_SIZE - 1)];
+    }
+
+    T& operator[](int index) const
+    {
+        return chunks[index >> CHUNK_SHIFT][index & (CHUNK_SIZE - 1)];
+    }
+};
+
+#endif //UTHREADS_CHUNKED_ARRAY_H
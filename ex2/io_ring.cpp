@@ -0,0 +1,174 @@
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "io_ring.h"
+
+IoRing::~IoRing()
+{
+    if(sqes){
+        munmap(sqes, sqes_size);
+    }
+    if(rings){
+        munmap(rings, rings_size);
+    }
+    if(ring_fd != -1){
+        close(ring_fd);
+    }
+}
+
+int IoRing::fd() const
+{
+    return ring_fd;
+}
+
+bool IoRing::busy() const
+{
+    return __atomic_load_n(&inflight, __ATOMIC_RELAXED) != 0;
+}
+
+bool IoRing::pending() const
+{
+    return __atomic_load_n(&queued, __ATOMIC_RELAXED) != 0;
+}
+
+#ifdef UTHREADS_IO_URING
+
+/**
+ * the submission and completion rings are mapped together (IORING_FEAT_SINGLE_MMAP, Linux 5.4), the submission
+ * entries on their own
+ */
+int IoRing::setup(unsigned entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+    if(fd == -1){
+        return -1;
+    }
+    if(!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_RW_CUR_POS)){
+        close(fd);
+        return -1;
+    }
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    size_t size = sq_size > cq_size ? sq_size : cq_size;
+    void* ring = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if(ring == MAP_FAILED){
+        close(fd);
+        return -1;
+    }
+    size_t entries_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    void* entry = mmap(nullptr, entries_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                       IORING_OFF_SQES);
+    if(entry == MAP_FAILED){
+        munmap(ring, size);
+        close(fd);
+        return -1;
+    }
+    char* base = (char*) ring;
+    ring_fd = fd;
+    rings = ring;
+    rings_size = size;
+    sqes = entry;
+    sqes_size = entries_size;
+    sq_head = (unsigned*) (base + params.sq_off.head);
+    sq_tail = (unsigned*) (base + params.sq_off.tail);
+    sq_mask = (unsigned*) (base + params.sq_off.ring_mask);
+    sq_array = (unsigned*) (base + params.sq_off.array);
+    sq_entries = params.sq_entries;
+    cq_head = (unsigned*) (base + params.cq_off.head);
+    cq_tail = (unsigned*) (base + params.cq_off.tail);
+    cq_mask = (unsigned*) (base + params.cq_off.ring_mask);
+    cqes = base + params.cq_off.cqes;
+    cq_entries = params.cq_entries;
+    return 0;
+}
+
+/**
+ * the kernel reads the entry once it sees the new tail, so the tail is stored with release order
+ */
+int IoRing::queue(uint8_t op, int fd, void* buf, unsigned len, uint64_t data)
+{
+    if(ring_fd == -1 || inflight >= cq_entries){
+        return -1;
+    }
+    unsigned tail = *sq_tail;
+    if(tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries){
+        return -1;
+    }
+    unsigned index = tail & *sq_mask;
+    struct io_uring_sqe* sqe = (struct io_uring_sqe*) sqes + index;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) buf;
+    sqe->len = len;
+    if(op != IORING_OP_FSYNC){
+        sqe->off = (uint64_t) -1; // the current file position
+    }
+    sqe->user_data = data;
+    sq_array[index] = index;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&queued, queued + 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&inflight, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+int IoRing::submit()
+{
+    if(!queued){
+        return 0;
+    }
+    int ret = (int) syscall(__NR_io_uring_enter, ring_fd, queued, 0, 0, nullptr, 0);
+    if(ret == -1){
+        return errno == EINTR || errno == EAGAIN || errno == EBUSY ? 0 : -1; // tried again on the next round
+    }
+    __atomic_store_n(&queued, queued - ret, __ATOMIC_RELAXED);
+    return ret;
+}
+
+int IoRing::reap(IoCompletion* out, int max)
+{
+    if(ring_fd == -1){
+        return 0;
+    }
+    unsigned head = *cq_head;
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    int count = 0;
+    while(head != tail && count < max){
+        struct io_uring_cqe* cqe = (struct io_uring_cqe*) cqes + (head & *cq_mask);
+        out[count].data = cqe->user_data;
+        out[count].result = cqe->res;
+        count ++;
+        head ++;
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    __atomic_sub_fetch(&inflight, count, __ATOMIC_RELAXED);
+    return count;
+}
+
+#else
+
+int IoRing::setup(unsigned entries)
+{
+    return -1;
+}
+
+int IoRing::queue(uint8_t op, int fd, void* buf, unsigned len, uint64_t data)
+{
+    return -1;
+}
+
+int IoRing::submit()
+{
+    return 0;
+}
+
+int IoRing::reap(IoCompletion* out, int max)
+{
+    return 0;
+}
+
+#endif
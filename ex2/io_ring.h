@@ -0,0 +1,106 @@
+#ifndef UTHREADS_IO_RING_H
+#define UTHREADS_IO_RING_H
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define UTHREADS_IO_URING
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#ifndef UTHREADS_IO_URING
+/* the library builds without the io_uring headers, setup then always fails and the poll path is used */
+#define IORING_OP_FSYNC 3
+#define IORING_OP_READ 22
+#define IORING_OP_WRITE 23
+#endif
+
+/**
+ * one completed operation: the data it was queued with and its result, a negated errno on failure
+ */
+struct IoCompletion{
+    uint64_t data;
+    int result;
+};
+
+/**
+ * io_uring instance driven through the raw system calls, without liburing.
+ * queue only writes the submission ring, which is shared memory, and submit hands everything queued since the last
+ * call to the kernel with a single io_uring_enter. completions are read straight from the completion ring, so a
+ * round of operations costs one system call no matter how many there are.
+ * the ring file descriptor is readable while completions are waiting, so it can be watched with epoll.
+ */
+class IoRing{
+    int ring_fd = -1;
+    void* rings = nullptr;
+    size_t rings_size = 0;
+    void* sqes = nullptr;
+    size_t sqes_size = 0;
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_mask = nullptr;
+    unsigned* sq_array = nullptr;
+    unsigned sq_entries = 0;
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned* cq_mask = nullptr;
+    void* cqes = nullptr;
+    unsigned cq_entries = 0;
+    unsigned queued = 0; // queued and not submitted yet
+    unsigned inflight = 0; // queued and not completed yet
+public :
+    IoRing() = default;
+
+    IoRing(const IoRing&) = delete;
+
+    IoRing& operator=(const IoRing&) = delete;
+
+    ~IoRing();
+
+    /**
+     * creates the ring. it fails if the kernel has no io_uring, does not allow it, or can not read and write at the
+     * current file position (before Linux 5.6)
+     * @param entries size of the submission ring
+     * @return 0 on success -1 otherwise
+     */
+    int setup(unsigned entries);
+
+    /**
+     * @return the ring file descriptor, -1 if setup did not succeed
+     */
+    int fd() const;
+
+    /**
+     * adds a read, write or fsync of fd to the submission ring. reads and writes use the current file position.
+     * @param data returned with the completion
+     * @return 0 on success, -1 if the ring is full or the completion ring could overflow
+     */
+    int queue(uint8_t op, int fd, void* buf, unsigned len, uint64_t data);
+
+    /**
+     * hands the queued operations to the kernel
+     * @return the number of operations submitted, -1 on failure
+     */
+    int submit();
+
+    /**
+     * takes up to max completions out of the completion ring
+     * @return the number of completions taken
+     */
+    int reap(IoCompletion* out, int max);
+
+    /**
+     * @return true if some operation has been queued and did not complete yet, read without the library lock
+     */
+    bool busy() const;
+
+    /**
+     * @return true if some operation has been queued and not submitted yet, read without the library lock
+     */
+    bool pending() const;
+};
+
+#endif //UTHREADS_IO_RING_H
@@ -15,7 +15,6 @@
 #ifdef __x86_64__
 /* code for 64 bit Intel arch */
 
-typedef unsigned long address_t;
 #define JB_SP 6
 #define JB_PC 7
 
@@ -34,7 +33,6 @@ address_t translate_address(address_t addr)
 #else
 /* code for 32 bit Intel arch */
 
-typedef unsigned int address_t;
 #define JB_SP 4
 #define JB_PC 5
 
@@ -57,43 +55,170 @@ address_t translate_address(address_t addr)
 
 typedef void (*thread_entry_point)(void);
 
-int current_thread = 0;
+static thread_local thread_context* current = nullptr; // context of the thread the calling worker runs
 
+void set_current_context(thread_context* context)
+{
+    current = context;
+}
+
+#ifdef UTHREADS_ASM_SWITCH
+
+/* slots of thread_context::regs */
+#ifdef __x86_64__
+#define CTX_SP 6
+#define CTX_PC 7
+#define CTX_FPU 8
+#define DEFAULT_FPU 0x037f00001f80UL /* fnstcw at +4, stmxcsr at +0 */
+#else
+#define CTX_SP 4
+#define CTX_PC 5
+#define CTX_FPU 6
+#define DEFAULT_FPU 0x037fU
+#endif
+
+extern "C" {
+/**
+ * saves the callee-saved registers of the caller into from and resumes to.
+ * returns when some other thread switches back to from.
+ */
+void uthreads_swap_context(thread_context* from, thread_context* to);
+/**
+ * resumes to without saving anything.
+ */
+void uthreads_load_context(thread_context* to);
+}
+
+#ifdef __x86_64__
+asm(".pushsection .text\n"
+    ".globl uthreads_swap_context\n"
+    ".type uthreads_swap_context,@function\n"
+    "uthreads_swap_context:\n"
+    "    movq %rbx, 0(%rdi)\n"
+    "    movq %rbp, 8(%rdi)\n"
+    "    movq %r12, 16(%rdi)\n"
+    "    movq %r13, 24(%rdi)\n"
+    "    movq %r14, 32(%rdi)\n"
+    "    movq %r15, 40(%rdi)\n"
+    "    leaq 8(%rsp), %rdx\n"
+    "    movq %rdx, 48(%rdi)\n"
+    "    movq (%rsp), %rdx\n"
+    "    movq %rdx, 56(%rdi)\n"
+    "    stmxcsr 64(%rdi)\n"
+    "    fnstcw 68(%rdi)\n"
+    "    movq %rsi, %rdi\n"
+    ".globl uthreads_load_context\n"
+    ".type uthreads_load_context,@function\n"
+    "uthreads_load_context:\n"
+    "    movq 0(%rdi), %rbx\n"
+    "    movq 8(%rdi), %rbp\n"
+    "    movq 16(%rdi), %r12\n"
+    "    movq 24(%rdi), %r13\n"
+    "    movq 32(%rdi), %r14\n"
+    "    movq 40(%rdi), %r15\n"
+    "    ldmxcsr 64(%rdi)\n"
+    "    fldcw 68(%rdi)\n"
+    "    movq 48(%rdi), %rsp\n"
+    "    jmp *56(%rdi)\n"
+    ".size uthreads_swap_context,.-uthreads_swap_context\n"
+    ".popsection\n");
+#else
+asm(".pushsection .text\n"
+    ".globl uthreads_swap_context\n"
+    ".type uthreads_swap_context,@function\n"
+    "uthreads_swap_context:\n"
+    "    movl 4(%esp), %eax\n"
+    "    movl 8(%esp), %edx\n"
+    "    movl %ebx, 0(%eax)\n"
+    "    movl %esi, 4(%eax)\n"
+    "    movl %edi, 8(%eax)\n"
+    "    movl %ebp, 12(%eax)\n"
+    "    leal 4(%esp), %ecx\n"
+    "    movl %ecx, 16(%eax)\n"
+    "    movl (%esp), %ecx\n"
+    "    movl %ecx, 20(%eax)\n"
+    "    fnstcw 24(%eax)\n"
+    "    movl %edx, %eax\n"
+    "    jmp 1f\n"
+    ".globl uthreads_load_context\n"
+    ".type uthreads_load_context,@function\n"
+    "uthreads_load_context:\n"
+    "    movl 4(%esp), %eax\n"
+    "1:  movl 0(%eax), %ebx\n"
+    "    movl 4(%eax), %esi\n"
+    "    movl 8(%eax), %edi\n"
+    "    movl 12(%eax), %ebp\n"
+    "    fldcw 24(%eax)\n"
+    "    movl 16(%eax), %esp\n"
+    "    jmp *20(%eax)\n"
+    ".size uthreads_swap_context,.-uthreads_swap_context\n"
+    ".popsection\n");
+#endif
+
+void jump_to_thread(thread_context* context)
+{
+    current = context;
+    uthreads_load_context(context);
+}
 
-void jump_to_thread(int tid, sigjmp_buf* env)
+/**
+ * @brief Saves the current thread state, and jumps to the other thread.
+ */
+void yield(thread_context* context)
 {
-    current_thread = tid;
-     siglongjmp(env[tid], 1);
+    thread_context* prev = current;
+    current = context;
+    uthreads_swap_context(prev, context);
+}
+
+
+
+void setup_thread(thread_context* context, char *stack, thread_entry_point entry_point, size_t stack_size)
+{
+    // initializes the context to use the right stack, and to run from the function 'entry_point', when we'll switch
+    // into the thread. sp is set as if entry_point had just been called.
+    address_t sp = (address_t) stack + stack_size - sizeof(address_t);
+    for(int i = 0; i < CONTEXT_REGS; i ++){
+        context->regs[i] = 0;
+    }
+    context->regs[CTX_SP] = sp;
+    context->regs[CTX_PC] = (address_t) entry_point;
+    context->regs[CTX_FPU] = DEFAULT_FPU;
+}
+
+#else
+
+void jump_to_thread(thread_context* context)
+{
+    current = context;
+     siglongjmp(context->env, 1);
 }
 
 /**
  * @brief Saves the current thread state, and jumps to the other thread.
  */
-void yield(int tid, sigjmp_buf* env)
+void yield(thread_context* context)
 {
-//    mask_alarm2();
-    int ret_val = sigsetjmp(env[current_thread], 1);
+    // the timer signal is never blocked at a switch, so there is no mask to save (and no sigprocmask on every switch)
+    int ret_val = sigsetjmp(current->env, 0);
     bool did_just_save_bookmark = ret_val == 0;
-//    bool did_jump_from_another_thread = ret_val != 0;
     if (did_just_save_bookmark)
     {
-        jump_to_thread(tid, env);
+        jump_to_thread(context);
     }
 }
 
 
 
-void setup_thread(int tid, char *stack, thread_entry_point entry_point, sigjmp_buf* env, int stack_size)
+void setup_thread(thread_context* context, char *stack, thread_entry_point entry_point, size_t stack_size)
 {
-    // initializes env[tid] to use the right stack, and to run from the function 'entry_point', when we'll use
+    // initializes the context to use the right stack, and to run from the function 'entry_point', when we'll use
     // siglongjmp to jump into the thread.
     address_t sp = (address_t) stack + stack_size - sizeof(address_t);
     address_t pc = (address_t) entry_point;
-    sigsetjmp(env[tid], 1);
-    (env[tid]->__jmpbuf)[JB_SP] = translate_address(sp);
-    (env[tid]->__jmpbuf)[JB_PC] = translate_address(pc);
-    sigemptyset(&env[tid]->__saved_mask);
+    sigsetjmp(context->env, 0);
+    (context->env->__jmpbuf)[JB_SP] = translate_address(sp);
+    (context->env->__jmpbuf)[JB_PC] = translate_address(pc);
 }
 
-
-
+#endif
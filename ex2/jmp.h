@@ -8,17 +8,49 @@
 #include <setjmp.h>
 #include "scheduler.h"
 
-void setup_thread(int tid, char *stack, thread_entry_point entry_point, sigjmp_buf* env, int stack_size);
+/*
+ * Context switch backend, chosen at compile time:
+ * on x86-64 and 32-bit Intel the threads are switched by the hand-written routine in jmp.cpp, which saves only the
+ * callee-saved registers, the stack pointer and the PC. Building with -DUTHREADS_SIGJMP_SWITCH (or on any other
+ * arch) falls back to sigsetjmp/siglongjmp with the translate_address pointer mangling.
+ */
+#if !defined(UTHREADS_SIGJMP_SWITCH) && (defined(__x86_64__) || defined(__i386__))
+#define UTHREADS_ASM_SWITCH
+#endif
+
+#ifdef __x86_64__
+typedef unsigned long address_t;
+#else
+typedef unsigned int address_t;
+#endif
+
+#ifdef __x86_64__
+#define CONTEXT_REGS 9 /* rbx, rbp, r12-r15, sp, pc, mxcsr + x87 control word */
+#else
+#define CONTEXT_REGS 7 /* ebx, esi, edi, ebp, sp, pc, x87 control word */
+#endif
+
+typedef struct thread_context{
+#ifdef UTHREADS_ASM_SWITCH
+    address_t regs[CONTEXT_REGS];
+#else
+    sigjmp_buf env;
+#endif
+}thread_context;
+
+void setup_thread(thread_context* context, char *stack, thread_entry_point entry_point, size_t stack_size);
 
 /**
- * @brief Saves the current thread state, and jumps to the other thread.
+ * @brief records the context of the thread that is running when the library starts (the main thread).
  */
-void yield(int tid, sigjmp_buf* env);
+void set_current_context(thread_context* context);
 
-
-void jump_to_thread(int tid, sigjmp_buf* env);
+/**
+ * @brief Saves the current thread state, and jumps to the other thread.
+ */
+void yield(thread_context* context);
 
 
+void jump_to_thread(thread_context* context);
 
 #endif //SCHEDULER_CPP_JMP_H
-
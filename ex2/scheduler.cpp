@@ -3,69 +3,454 @@
 //
 
 #include <cstdio>
+#include <csignal>
+#include <sched.h>
+#include <cerrno>
+#include <climits>
+#include <ctime>
+#include <functional>
+#include <new>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
 #include "scheduler.h"
+#include "tsc.h"
+#include "trace.h"
 #define SYSTEM_CALL_ERROR "system error: "
+#define IO_EVENTS 64 // file descriptors taken from the epoll set at a time, and completions from the ring
+#define STRIDE_UNIT (1L << 20) // pass added for one quantum of a thread with weight 1
+#define LOCK_SPINS 100 // spins on a thread lock before giving the CPU to the holder
+
+static thread_local Worker* current_worker = nullptr;
+
+/**
+ * takes the lock of the thread. only needed with more than one worker, where the workers that switch threads without
+ * the library lock read and change status, is_sleep and on_cpu.
+ */
+static void lock_thread(Thread* thread, bool stealing){
+    if(!stealing){
+        return;
+    }
+    int spins = 0;
+    while(__atomic_exchange_n(&thread->lock, 1, __ATOMIC_ACQUIRE)){
+        while(__atomic_load_n(&thread->lock, __ATOMIC_RELAXED)){
+            if(++spins == LOCK_SPINS){
+                sched_yield();
+                spins = 0;
+            }
+        }
+    }
+}
+
+static void unlock_thread(Thread* thread, bool stealing){
+    if(stealing){
+        __atomic_store_n(&thread->lock, 0, __ATOMIC_RELEASE);
+    }
+}
 
 /**
  * spawn a Thread by changing allThreads[tid] to tid instead of -1
- * add the Thread to the readyVed
+ * allocating the chunk of allThreads that holds tid if this is the first thread in it
+ * the Thread stays BLOCKED until start is called, so no worker runs it before its context is set up
  * set the quantum to quantum
  * @param tid
  * @param entry_point
+ * @param stack_size the stack size the thread asked for, 0 for the default one
+ * @param priority the run queue level of the thread
  * @return 0 on success -1 otherwise
  */
-int Scheduler::spawn(int tid, thread_entry_point * entry_point){
+int Scheduler::spawn(int tid, thread_entry_point entry_point, size_t stack_size, int priority){
+    if(allThreads.ensure(tid) == -1){
+        fprintf(stderr, SYSTEM_CALL_ERROR "ERROR ALLOCATING MEMORY");
+        return -1;
+    }
     if(allThreads[tid].tid != -1){return -1;}
-    readyVec.push(&allThreads[tid]);
-    allThreads[tid].tid = tid;
-    allThreads[tid].status = READY;
-    allThreads[tid].entry_point = entry_point;
-    allThreads[tid].quantum = 1;
-    allThreads[tid].sleep = 0;
-    allThreads[tid].is_sleep = false;
     if(tid != 0){
-
-        allThreads[tid].stack = new char[max_stack_size];
+        allThreads[tid].stack_size = StackPool::stack_size(stack_size ? stack_size : default_stack_size);
+        allThreads[tid].stack = stackPool.acquire(allThreads[tid].stack_size);
         if(!allThreads[tid].stack){
             fprintf(stderr, SYSTEM_CALL_ERROR "ERROR ALLOCATING MEMORY");
+            return -1;
         }
     }
+    freeTids.take(tid);
+    lock_thread(&allThreads[tid], stealing);
+    allThreads[tid].status = BLOCKED;
+    allThreads[tid].tid = tid;
+    unlock_thread(&allThreads[tid], stealing);
+    allThreads[tid].priority = priority;
+    allThreads[tid].weight = UTHREAD_DEFAULT_WEIGHT;
+    allThreads[tid].slice = 1;
+    allThreads[tid].pass = 0;
+    allThreads[tid].start_routine = nullptr;
+    allThreads[tid].arg = nullptr;
+    allThreads[tid].retval = nullptr;
+    allThreads[tid].detached = true;
+    allThreads[tid].cancel = false;
+    allThreads[tid].io_seq = 0;
+    allThreads[tid].io_fd = -1;
+    allThreads[tid].chan_data = nullptr;
+    allThreads[tid].worker = self()->index;
+    allThreads[tid].entry_point = entry_point;
+    allThreads[tid].quantum = 1;
+    allThreads[tid].wake = 0;
+    allThreads[tid].is_sleep = false;
+    if(ThreadStats* thread_stats = stats.find(tid)){
+        thread_stats->start(Tsc::now_ns());
+    }
+    TRACE(tid, TRACE_NO_STATUS, BLOCKED, TRACE_SPAWN);
     return 0;
 }
 
+/**
+ * adds a spawned Thread to the ready queue
+ * @param tid
+ */
+void Scheduler::start(int tid){
+    TRACE(tid, BLOCKED, READY, TRACE_START);
+    make_ready(&allThreads[tid]);
+}
+
 /**
  * update the running Thread to READY status
- * if it's sleep <= 0
+ * if it is not sleeping, not an idle thread and was not blocked by another worker while it ran
  * schedule the next thread to running and add the running Thread to the back of the readyVec queue
- * else if sleep > 0 schedule another thread to run
+ * else schedule another thread to run
+ * @param yielded the switch is counted as voluntary in the statistics of the thread, instead of involuntary
  * @return 0
  */
-int Scheduler::preempt(){
-    if(running->sleep <= 0){
-        running->status = READY;
-        readyVec.push(running);
+int Scheduler::preempt(bool yielded){
+    Worker* worker = self();
+    worker->preempted = !yielded;
+    if(stealing){
+        preempt_stealing();
+        worker->preempted = false;
+        return 0;
+    }
+    Thread* thread = running();
+    if(!thread->is_sleep && thread->status == RUNNING && !is_idle(thread)){
+        make_ready(thread);
     }
     schedule();
+    worker->preempted = false;
+    return 0;
+}
+
+/**
+ * preempt with more than one worker, called without the library lock.
+ * the running Thread is only published as READY by finish_switch, once its context is saved, so no other worker
+ * picks it up half switched. it keeps running if no other thread can be found, and the idle thread takes over if it
+ * is not RUNNING anymore.
+ * @return 0
+ */
+int Scheduler::preempt_stealing(){
+    Worker* worker = self();
+    Thread* thread = worker->running;
+    bool idle = thread == &worker->idle;
+    if(idle){
+        __atomic_store_n(&worker->kicked, false, __ATOMIC_RELAXED);
+    }
+    Thread* next = pick(true);
+    if(!next){
+        if(idle){
+            return 0;
+        }
+        lock_thread(thread, stealing);
+        bool keep = thread->status == RUNNING && !thread->is_sleep;
+        unlock_thread(thread, stealing);
+        if(keep){
+            return 0;
+        }
+        next = &worker->idle;
+    }
+    if(!idle){
+        worker->prev = thread;
+    }
+    set_running(worker, next);
     return 0;
 }
 
 /**
  *
- * update the front ready Thread in the readyVec to running pointer
+ * update the first ready Thread of the highest priority in the readyVec of the calling worker to running pointer
  * change its state RUNNING state
  * pop the readyVec queue
- * @return 0 upon success -1 otherwise
+ * when no thread is READY the worker switches to its idle thread
+ * with more than one worker the thread comes from the deques instead
+ * @return 0
  */
 int Scheduler::schedule(){
-    if(readyVec.empty() || readyVec.front()->tid == -1){
-        return -1;
+    Worker* worker = self();
+    if(stealing){
+        Thread* thread = worker->running;
+        Thread* next = pick(false);
+        if(thread && thread != &worker->idle){
+            worker->prev = thread;
+        }
+        set_running(worker, next ? next : &worker->idle);
+        return 0;
+    }
+    if(worker->readyVec.empty()){
+        // the idle thread waits in the kernel until a sleeper is due or some I/O is ready
+        worker->idle.status = RUNNING;
+        set_running(worker, &worker->idle);
+        return 0;
     }
-    running = readyVec.front();
-    running->status = RUNNING;
-    readyVec.pop();
+    Thread* next = worker->readyVec.pop();
+    next->status = RUNNING;
+    set_running(worker, next);
     return 0;
 }
 
+/**
+ * sets the thread READY and adds it to the ready queue, called with the lock of the thread held.
+ * with more than one worker it goes to the bottom of the deque of the calling worker, unless some worker is still
+ * switching away from it, then finish_switch adds it.
+ * @param thread
+ * @return true if the thread was added to a deque
+ */
+bool Scheduler::enqueue(Thread* thread){
+    thread->status = READY;
+    account_ready(thread);
+    if(!stealing){
+        self()->readyVec.push(thread);
+        return false;
+    }
+    if(thread->on_cpu){
+        return false;
+    }
+    self()->deque.push(thread);
+    return true;
+}
+
+/**
+ * sets the thread READY and adds it to the ready queue.
+ * an idle worker waits for its timer signal, so one of them is sent a signal right away instead of finding the
+ * thread a quantum later.
+ * @param thread
+ */
+void Scheduler::make_ready(Thread* thread){
+    lock_thread(thread, stealing);
+    bool pushed = enqueue(thread);
+    unlock_thread(thread, stealing);
+    if(pushed){
+        kick_idle_worker();
+    }
+}
+
+/**
+ * makes the calling worker run the thread, if it is READY and no other worker took it first
+ * @param thread
+ * @return true if the thread is now RUNNING on the calling worker
+ */
+bool Scheduler::claim(Thread* thread){
+    lock_thread(thread, stealing);
+    bool ready = thread->tid != -1 && thread->status == READY && !thread->is_sleep && !thread->on_cpu;
+    if(ready){
+        thread->status = RUNNING;
+        thread->on_cpu = true;
+        thread->worker = self()->index;
+    }
+    unlock_thread(thread, stealing);
+    return ready;
+}
+
+/**
+ * finds the next thread for the calling worker: first in its own deque, then in the deques of the other workers.
+ * a preempted thread goes to the bottom of the deque, so preemption takes from the top of the own deque to keep the
+ * threads going round-robin. a thread that blocked takes the last thread that became READY instead, which is the
+ * one its wake-up most likely made runnable, and whose memory is still in the cache.
+ * the deques may hold threads that were blocked, terminated or taken by another worker since they were added, those
+ * are dropped.
+ * @param fifo take from the top of the own deque instead of the bottom
+ * @return the claimed thread, nullptr if there is none
+ */
+Thread* Scheduler::pick(bool fifo){
+    Worker* worker = self();
+    Thread* thread;
+    while((thread = fifo ? worker->deque.steal() : worker->deque.pop())){
+        if(claim(thread)){
+            return thread;
+        }
+    }
+    int count = (int) workers.size();
+    for(int i = 1; i < count; i ++){
+        WorkDeque& victim = workers[(worker->index + i) % count]->deque;
+        while((thread = victim.steal())){
+            if(claim(thread)){
+                return thread;
+            }
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * makes next the running thread of the worker, records the switch in the statistics of both threads and keeps count
+ * of the idle workers
+ * @param worker
+ * @param next
+ */
+void Scheduler::set_running(Worker* worker, Thread* next){
+    Thread* prev = worker->running;
+    if(prev != next){
+        account_switch(worker, prev, next);
+    }
+    if(stealing){
+        bool was_idle = prev == &worker->idle;
+        bool idle = next == &worker->idle;
+        if(idle && !was_idle){
+            __atomic_add_fetch(&idle_workers, 1, __ATOMIC_RELAXED);
+        }else if(was_idle && !idle){
+            __atomic_sub_fetch(&idle_workers, 1, __ATOMIC_RELAXED);
+        }
+    }
+    __atomic_store_n(&worker->running, next, __ATOMIC_RELEASE);
+}
+
+/**
+ * prev stops running: it waits in a run queue if it is still RUNNING or READY and not sleeping, otherwise it is
+ * blocked. the switch goes to the statistics and the trace of both threads, a thread that terminated was traced by
+ * terminate and the idle threads are left out.
+ * @param worker
+ * @param prev the thread switched away from, nullptr on the first switch of a worker
+ * @param next
+ */
+void Scheduler::account_switch(Worker* worker, Thread* prev, Thread* next){
+    uint64_t ticks = Tsc::read(); // one clock read for the statistics and the trace of both threads
+    long now = Tsc::to_ns(ticks);
+    ThreadStats* thread_stats;
+    if(prev && !is_idle(prev) && prev->tid != -1 && prev->status != ZOMBIE){
+        bool runnable = (prev->status == RUNNING || prev->status == READY) && !prev->is_sleep;
+        if((thread_stats = stats.find(prev->tid))){
+            thread_stats->stop(now, runnable, worker->preempted);
+        }
+        TRACE_AT(ticks, prev->tid, RUNNING, runnable ? READY : prev->status, prev->is_sleep ? TRACE_SLEEP :
+                 !runnable ? TRACE_BLOCK : worker->preempted ? TRACE_PREEMPT : TRACE_YIELD);
+    }
+    if(!is_idle(next)){
+        if((thread_stats = stats.find(next->tid))){
+            thread_stats->dispatch(now);
+        }
+        TRACE_AT(ticks, next->tid, READY, RUNNING, TRACE_SCHEDULE);
+    }
+}
+
+/**
+ * the thread became READY, its blocked time ends. the clock is only read if it was blocked.
+ * @param thread
+ */
+void Scheduler::account_ready(Thread* thread){
+    ThreadStats* thread_stats = stats.find(thread->tid);
+    if(thread_stats && thread_stats->phase == STATS_BLOCK){
+        thread_stats->ready(Tsc::now_ns());
+    }
+}
+
+/**
+ * sends the timer signal to one idle worker other than the calling one, so it steals the thread that was just added.
+ * a worker that was already sent one and did not look yet is skipped.
+ */
+void Scheduler::kick_idle_worker(){
+    if(!__atomic_load_n(&idle_workers, __ATOMIC_RELAXED)){
+        return;
+    }
+    Worker* me = self();
+    for(Worker* worker : workers){
+        pid_t kernel_tid = __atomic_load_n(&worker->kernel_tid, __ATOMIC_RELAXED);
+        if(worker == me || !kernel_tid || __atomic_load_n(&worker->running, __ATOMIC_ACQUIRE) != &worker->idle){
+            continue;
+        }
+        if(!__atomic_exchange_n(&worker->kicked, true, __ATOMIC_ACQ_REL)){
+            syscall(SYS_tgkill, getpid(), kernel_tid, SIGVTALRM);
+            return;
+        }
+    }
+}
+
+/**
+ * the context of prev is saved now, so it is no longer on a CPU. it goes to the bottom of the deque of the calling
+ * worker if it is still RUNNING (it was preempted) or became READY while it was switched away from.
+ */
+void Scheduler::finish_switch(){
+    Worker* worker = self();
+    Thread* thread = worker->prev;
+    if(!thread){
+        return;
+    }
+    worker->prev = nullptr;
+    lock_thread(thread, stealing);
+    thread->on_cpu = false;
+    if(thread->status == RUNNING){
+        thread->status = READY;
+    }
+    bool ready = thread->tid != -1 && thread->status == READY && !thread->is_sleep;
+    if(ready){
+        account_ready(thread); // it may have been resumed while it was switched away from
+        worker->deque.push(thread);
+    }
+    unlock_thread(thread, stealing);
+    if(ready){
+        kick_idle_worker();
+    }
+}
+
+/**
+ * with a single worker only the running thread is on the CPU, and the library lock is not used
+ * @param thread
+ * @return false if a worker runs the thread right now
+ */
+bool Scheduler::stop(Thread* thread){
+    if(!stealing){
+        return !on_cpu(thread);
+    }
+    while(true){
+        lock_thread(thread, stealing);
+        if(!thread->on_cpu){
+            thread->status = BLOCKED;
+            unlock_thread(thread, stealing);
+            return true;
+        }
+        if(__atomic_load_n(&workers[thread->worker]->running, __ATOMIC_ACQUIRE) == thread){
+            thread->cancel = true;
+            unlock_thread(thread, stealing);
+            return false;
+        }
+        unlock_thread(thread, stealing); // its worker is switching away from it, wait until it is done
+        sched_yield();
+    }
+}
+
+void Scheduler::update_wake_hint(){
+    __atomic_store_n(&wake_hint, next_wake(), __ATOMIC_RELAXED);
+    __atomic_store_n(&timed_hint, next_wake_us(), __ATOMIC_RELAXED);
+}
+
+/**
+ * the clock is only read while some thread sleeps until a deadline
+ */
+bool Scheduler::sleepers_due() const{
+    long wake = __atomic_load_n(&wake_hint, __ATOMIC_RELAXED);
+    if(wake != -1 && wake <= __atomic_load_n(&quantum, __ATOMIC_RELAXED)){
+        return true;
+    }
+    long deadline = __atomic_load_n(&timed_hint, __ATOMIC_RELAXED);
+    return deadline != -1 && deadline <= now_us();
+}
+
+/**
+ * takes a sleeping thread out of the sleep heap it is in
+ */
+void Scheduler::remove_sleeper(Thread* thread){
+    if(thread->heap_index != -1){
+        sleepHeap.remove(thread);
+    }
+    if(thread->timed_index != -1){
+        timedHeap.remove(thread);
+    }
+    update_wake_hint();
+}
+
 /**
  * blocks the Thread by changing the state of the Thread in the allThreads list to BLOCKED
  * and if it was running schedule the next Thread
@@ -75,19 +460,27 @@ int Scheduler::schedule(){
  *          -1 on failure
  */
 int Scheduler::block(int tid){
-    if(tid < 0 || tid >= max_stack_size){
+    if(!find(tid)){
         return -1;
     }
-    if(running && tid == running->tid && !running->is_sleep){
-        allThreads[tid].status = BLOCKED;
-        schedule();
+    Thread* thread = &allThreads[tid];
+    lock_thread(thread, stealing);
+    if(thread->status == BLOCKED){
+        unlock_thread(thread, stealing);
         return 0;
-    }if(running->is_sleep){
-        allThreads[tid].status = BLOCKED;
+    }
+    if(thread == running()){
+        thread->status = BLOCKED;
+        unlock_thread(thread, stealing);
+        schedule();
         return 0;
     }
-    allThreads[tid].status = BLOCKED;
-    removeFromReadyVec(tid);
+    if(!thread->is_sleep){
+        removeFromReadyVec(tid);
+    }
+    TRACE(tid, thread->status, BLOCKED, TRACE_BLOCK);
+    thread->status = BLOCKED; // with more than one worker it may still be in a deque, it is dropped when found
+    unlock_thread(thread, stealing);
     return 0;
 }
 
@@ -97,25 +490,44 @@ int Scheduler::block(int tid){
   * if the thread is does not exist return an error
   * if the thread is in RUNNING OR READY status does nothing
   * if  the thread is sleeping change the status to ready and do not add the thread to the ready queue
+  * if the thread waits in a wait queue does nothing
+  * if the thread was blocked while another worker still runs it, it just keeps running
   * @param tid
   * @return 0 on success -1 otherwise
 */
 int Scheduler::resume(int tid){
-    if(allThreads[tid].tid == -1){
+    if(!find(tid)){
         return -1;
     }
-    if(allThreads[tid].is_sleep){
-        allThreads[tid].status = READY;
-        return 0;
+    Thread* thread = &allThreads[tid];
+    bool pushed = false;
+    lock_thread(thread, stealing);
+    if(thread->is_sleep){
+        if(thread->status == BLOCKED){
+            TRACE(tid, BLOCKED, READY, TRACE_RESUME);
+        }
+        thread->status = READY;
+    }
+    else if(thread->status == RUNNING || thread->status == READY || thread->queue){
+        // already running or ready, or waiting in a wait queue that only unpark releases it from
+    }
+    else if(on_cpu(thread)){
+        TRACE(tid, BLOCKED, RUNNING, TRACE_RESUME);
+        thread->status = RUNNING;
+    }
+    else{
+        TRACE(tid, BLOCKED, READY, TRACE_RESUME);
+        pushed = enqueue(thread);
+    }
+    unlock_thread(thread, stealing);
+    if(pushed){
+        kick_idle_worker();
     }
-    if(allThreads[tid].status == RUNNING || allThreads[tid].status == READY){return 0;}
-    allThreads[tid].status = READY;
-    readyVec.push(&allThreads[tid]);
     return 0;
 }
 
 /**
- * set the tid of the thread at allThreads[tid] to -1
+ * set the tid of the thread at allThreads[tid] to -1, or make it a ZOMBIE and wake its joiners if it is not detached
  * set the quantum to 0
  * and remove it from the readyVec
  * if tid does not exist return -1
@@ -126,35 +538,107 @@ int Scheduler::resume(int tid){
  *          -1 if the thread does not exist
  */
 int Scheduler::terminate(int tid){
-    if(allThreads[tid].tid == -1){
+    if(!find(tid)){
         return -1;
     }
     if(allThreads[tid].is_sleep){
-        remove_from_sleepVec(tid);
+        remove_sleeper(&allThreads[tid]);
     }
     else if(allThreads[tid].status == READY){
         removeFromReadyVec(tid);
     }
-    delete[] allThreads[tid].stack;
+    else if(allThreads[tid].queue){
+        ThreadQueue* queue = allThreads[tid].queue;
+        queue->remove(&allThreads[tid]);
+        int fd = allThreads[tid].io_fd;
+        if(fd != -1 && (queue == &ioWaits[fd].readers || queue == &ioWaits[fd].writers)){
+            disarm(fd);
+        }
+    }
+    if(allThreads[tid].stack && allThreads[tid].io_seq){
+        OrphanStack orphan = {((uint64_t) allThreads[tid].io_seq << 32) | (uint32_t) tid, allThreads[tid].stack,
+                              allThreads[tid].stack_size};
+        orphanStacks.push_back(orphan); // its I/O may still write to it
+    }
+    else if(allThreads[tid].stack){
+        stackPool.release(allThreads[tid].stack, allThreads[tid].stack_size);
+    }
+    allThreads[tid].io_seq = 0;
     allThreads[tid].stack = nullptr;
-    allThreads[tid].tid = -1;
     allThreads[tid].quantum = 0;
-    allThreads[tid].sleep = 0;
-    if(allThreads[tid].status == RUNNING && !allThreads[tid].is_sleep){
+    allThreads[tid].wake = 0;
+    bool was_running = on_cpu(&allThreads[tid]);
+    allThreads[tid].is_sleep = false;
+    if(ThreadStats* thread_stats = stats.find(tid)){
+        long now = Tsc::now_ns();
+        thread_stats->retire(now);
+        thread_stats->add_to(now, &retired);
+    }
+    TRACE(tid, allThreads[tid].status, allThreads[tid].detached ? TRACE_NO_STATUS : ZOMBIE, TRACE_TERMINATE);
+    if(allThreads[tid].detached){
+        reap(tid);
+    }else{
+        lock_thread(&allThreads[tid], stealing);
+        allThreads[tid].status = ZOMBIE;
+        unlock_thread(&allThreads[tid], stealing);
+        while(unpark(allThreads[tid].joiners)){
+        }
+    }
+    if(was_running){
         schedule();
         return 1;
     }
-    allThreads[tid].is_sleep = false;
-    allThreads[tid].status = READY;
     return 0;
 }
 
+/**
+ * a terminated thread was retired by terminate, so the statistics of a ZOMBIE thread do not grow anymore
+ */
+int Scheduler::get_stats(int tid, uthread_stats* out) const{
+    ThreadStats* thread_stats = stats.find(tid);
+    if(!find_any(tid) || !thread_stats){
+        return -1;
+    }
+    *out = uthread_stats();
+    thread_stats->add_to(Tsc::now_ns(), out);
+    return 0;
+}
+
+/**
+ * the threads that terminated are only counted in retired, their own statistics are STATS_DEAD.
+ * the tids in use are found in the bitmap of free tids, so the threads themselves are not read.
+ */
+void Scheduler::get_process_stats(uthread_stats* out) const{
+    *out = retired;
+    long now = Tsc::now_ns();
+    for(int tid = freeTids.next_taken(0); tid != -1; tid = freeTids.next_taken(tid + 1)){
+        ThreadStats* thread_stats = stats.find(tid);
+        if(!thread_stats || thread_stats->phase == STATS_DEAD){
+            continue;
+        }
+        thread_stats->add_to(now, out);
+    }
+}
+
+/**
+ * releases the tid of a terminated thread so it can be given to a new thread
+ * @param tid
+ */
+void Scheduler::reap(int tid){
+    lock_thread(&allThreads[tid], stealing);
+    allThreads[tid].tid = -1;
+    allThreads[tid].status = READY;
+    unlock_thread(&allThreads[tid], stealing);
+    allThreads[tid].retval = nullptr;
+    freeTids.release(tid);
+}
+
 
 /**
- * this function updates the thread sleep quantum and the data structure in Scheduler by :
- * if the thread is in ready status -> remove it from the ready queue, and add it to the sleep queue
- * if the thread is in blocked status -> just add it to the sleep queue,
- * if the thread is in running status -> add it to the sleep queue and preempt the next thread.
+ * this function puts the thread in the sleep heap until the total quantum reaches quantum + sleep_quantum:
+ * if the thread is in ready status -> remove it from the ready queue,
+ * if the thread is in blocked status -> it stays blocked after it wakes up,
+ * if the thread is running -> schedule the next thread.
  * @param tid
  * @return 0 upon success
  *         -1 otherwise
@@ -163,55 +647,96 @@ int Scheduler::sleep(int tid, int sleep_quantum) {
     if(tid <= 0){
         return -1;
     }
-    allThreads[tid].sleep = sleep_quantum;
-    allThreads[tid].is_sleep = true;
-    if(allThreads[tid].status == RUNNING){
-        sleepVec.push(running);
+    if(allThreads[tid].is_sleep){
+        remove_sleeper(&allThreads[tid]);
+    }else if(allThreads[tid].status == READY){
+        removeFromReadyVec(tid);
+    }
+    allThreads[tid].wake = quantum + sleep_quantum;
+    return start_sleep(&allThreads[tid], sleepHeap);
+}
+
+/**
+ * like sleep, but the thread wakes up at the first switch after the deadline instead of after a number of quantums
+ * @param tid
+ * @param deadline CLOCK_MONOTONIC time in microseconds
+ * @return 0 upon success
+ *         -1 otherwise
+ */
+int Scheduler::sleep_until(int tid, long deadline) {
+    if(tid <= 0){
+        return -1;
+    }
+    if(allThreads[tid].is_sleep){
+        remove_sleeper(&allThreads[tid]);
+    }else if(allThreads[tid].status == READY){
+        removeFromReadyVec(tid);
+    }
+    allThreads[tid].wake_us = deadline;
+    return start_sleep(&allThreads[tid], timedHeap);
+}
+
+/**
+ * marks the thread as sleeping and adds it to heap, once its wake time is set.
+ * if it was running, schedule the next thread.
+ * @return 0
+ */
+int Scheduler::start_sleep(Thread* thread, ThreadHeap& heap) {
+    lock_thread(thread, stealing);
+    thread->is_sleep = true;
+    bool was_running = thread == running();
+    if(thread->status == RUNNING){
+        thread->status = READY;
+    }
+    unlock_thread(thread, stealing);
+    if(!was_running){
+        TRACE(thread->tid, thread->status, thread->status, TRACE_SLEEP); // a running thread is traced by the switch
+    }
+    heap.push(thread);
+    update_wake_hint();
+    if(was_running){
         schedule();
-        return 0;
     }
-    sleepVec.push(&allThreads[tid]);
     return 0;
 }
 
 /**
- * iterate over the queue of readyVec and remove tid and blocked thread from the queue
+ * unlink tid from the readyVec of its worker
  * @param tid
  */
 void Scheduler::removeFromReadyVec(int tid)
 {
-    if(readyVec.empty()){
-        return;
-    }
-    if(readyVec.front()->tid == tid){
-        readyVec.pop();
-        return;
-    }
-    Thread* temp = readyVec.front();
-    readyVec.push(readyVec.front());
-    readyVec.pop();
-    while(temp != readyVec.front()){
-        if(readyVec.front()->tid == tid){
-            readyVec.pop();
-        }
-        readyVec.push(readyVec.front());
-        readyVec.pop();
-    }
+    workers[allThreads[tid].worker]->readyVec.remove(&allThreads[tid]);
 }
 
 /**
  * constructor
- * @param max_size
+ * the thread table starts empty and grows a chunk at a time as threads are spawned
+ * the calling kernel thread becomes worker 0
+ * @param max_size the maximal number of threads
+ * @param max_stack_size the stack size of threads that do not ask for one
+ * @param policy UTHREAD_SCHED_PRIORITY or UTHREAD_SCHED_FAIR
+ * @param worker_count the number of kernel threads that run the threads
  */
-Scheduler::Scheduler(int max_size, int max_stack_size)
+Scheduler::Scheduler(int max_size, size_t max_stack_size, int policy, int worker_count) :
+        stealing(worker_count > 1),
+        sleepHeap(&Thread::wake, &Thread::heap_index),
+        timedHeap(&Thread::wake_us, &Thread::timed_index),
+        freeTids(max_size)
 {
-    this->max_stack_size = max_stack_size;
-    allThreads = new Thread[max_size];
-    if(!allThreads){
-        fprintf(stderr, SYSTEM_CALL_ERROR "ERROR ALLOCATING MEMORY");
+    max_threads = max_size;
+    default_stack_size = max_stack_size;
+    allThreads.reserve(max_size);
+    sleepHeap.reserve(max_size); // sleeping never allocates, so it can not fail while the timer is deferred
+    timedHeap.reserve(max_size);
+    Tsc::calibrate();
+    stats.init(max_size); // without it the library runs on, without statistics
+    Trace::init(worker_count); // without it, or without -DUTHREADS_TRACE, nothing is traced
+    for(int i = 0; i < worker_count; i ++){
+        workers.push_back(new Worker(i, policy, max_size));
     }
-    running = nullptr;
     quantum = 0;
+    enter_worker(0);
 }
 
 /**
@@ -219,50 +744,843 @@ Scheduler::Scheduler(int max_size, int max_stack_size)
  */
 Scheduler::~Scheduler()
 {
-    delete[] allThreads;
-    allThreads = nullptr;
+    if(epoll_fd != -1){
+        close(epoll_fd);
+    }
+    for(Worker* worker : workers){
+        delete worker;
+    }
+    current_worker = nullptr;
 }
 
-int Scheduler::is_readyVec_empty() {
-    return readyVec.empty();
+Worker::Worker(int index, int policy, int max_threads) : index(index), readyVec(policy, max_threads), deque(max_threads)
+{
+    idle.worker = index;
 }
 
-void Scheduler::remove_from_sleepVec(int tid){
-    if(sleepVec.empty()){return;}
-    if(sleepVec.front()->tid == tid){
-        sleepVec.pop();
-        return;
+void* Worker::operator new(size_t size)
+{
+    void* memory;
+    if(posix_memalign(&memory, alignof(Worker), size) != 0){
+        throw std::bad_alloc();
     }
-    Thread* temp = sleepVec.front();
-    sleepVec.push(sleepVec.front());
-    sleepVec.pop();
-    while(temp != sleepVec.front()){
-        if(sleepVec.front()->tid == tid){
-            sleepVec.pop();
-        }
-        sleepVec.push(sleepVec.front());
-        sleepVec.pop();
+    return memory;
+}
+
+void Worker::operator delete(void* memory)
+{
+    free(memory);
+}
+
+/**
+ * the accessor is not inlined so the compiler re-reads the thread local every time
+ */
+__attribute__((noinline)) Worker* Scheduler::self()
+{
+    return current_worker;
+}
+
+void Scheduler::enter_worker(int index)
+{
+    current_worker = workers[index];
+    if(index != 0){
+        current_worker->idle.status = RUNNING;
+        set_running(current_worker, &current_worker->idle);
     }
+    __atomic_store_n(&current_worker->kernel_tid, (pid_t) syscall(SYS_gettid), __ATOMIC_RELEASE);
+}
+
+Thread* Scheduler::running() const
+{
+    return self()->running;
 }
 
 /**
- * get the thread out of the sleep queue and add it to the ready queue if it is not blocked
- * @param tid
- * @return 0 upon success
- *         -1 otherwise
+ * with more than one worker this includes a thread that a worker is still switching away from
  */
-int Scheduler::exit_sleep(int tid) {
-    if(tid < 0){
-        return -1;
+bool Scheduler::on_cpu(const Thread* thread) const
+{
+    if(stealing){
+        return __atomic_load_n(&thread->on_cpu, __ATOMIC_RELAXED);
     }
-    if(allThreads[tid].status == RUNNING){
-        remove_from_sleepVec(tid);
-        readyVec.push(&allThreads[tid]);
-        allThreads[tid].status = READY;
-    }else if(allThreads[tid].status == BLOCKED){
-        remove_from_sleepVec(tid);
+    return workers[thread->worker]->running == thread;
+}
+
+bool Scheduler::is_idle(const Thread* thread) const
+{
+    return thread == &workers[thread->worker]->idle;
+}
+
+/**
+ * @return the smallest tid that is not in use, -1 if all of them are
+ */
+int Scheduler::get_new_tid() const {
+    return freeTids.lowest();
+}
+
+int Scheduler::thread_limit() const {
+    return max_threads;
+}
+
+/**
+ * @param tid
+ * @return the thread with this tid, nullptr if no such thread exists or it is a ZOMBIE
+ */
+Thread* Scheduler::find(int tid) const {
+    Thread* thread = find_any(tid);
+    if(!thread || thread->status == ZOMBIE){
+        return nullptr;
     }
-    allThreads[tid].is_sleep = false;
-    return 0;
+    return thread;
 }
 
+/**
+ * @param tid
+ * @return the thread with this tid, including a ZOMBIE one, nullptr if no such thread exists
+ */
+Thread* Scheduler::find_any(int tid) const {
+    if(tid < 0 || tid >= max_threads){
+        return nullptr;
+    }
+    Thread* thread = allThreads.find(tid);
+    if(!thread || thread->tid == -1){
+        return nullptr;
+    }
+    return thread;
+}
+
+/**
+ * with more than one worker, true if the deques of all the workers looked empty
+ */
+int Scheduler::is_readyVec_empty() {
+    if(stealing){
+        for(Worker* worker : workers){
+            if(!worker->deque.empty()){
+                return 0;
+            }
+        }
+        return 1;
+    }
+    return self()->readyVec.empty();
+}
+
+/**
+ * changes the priority of tid. a READY thread moves to the end of the queue of its new level, the new priority of a
+ * RUNNING, BLOCKED or sleeping thread takes effect the next time it becomes READY.
+ * only called with a single worker, the deques of more than one worker have no priorities.
+ * @param tid
+ * @param priority
+ * @return 0 upon success
+ *         -1 otherwise
+ */
+int Scheduler::set_priority(int tid, int priority) {
+    Thread* thread = find(tid);
+    if(!thread){
+        return -1;
+    }
+    RunQueue& readyVec = workers[thread->worker]->readyVec;
+    if(readyVec.contains(thread)){
+        readyVec.remove(thread);
+        thread->priority = priority;
+        readyVec.push(thread);
+        return 0;
+    }
+    thread->priority = priority;
+    return 0;
+}
+
+/**
+ * changes the weight of tid. a READY thread is put back in the run queue so the fair order sees the new weight.
+ * only called with a single worker, the deques of more than one worker have no weights.
+ * @param tid
+ * @param weight
+ * @return 0 upon success
+ *         -1 otherwise
+ */
+int Scheduler::set_weight(int tid, int weight) {
+    Thread* thread = find(tid);
+    if(!thread){
+        return -1;
+    }
+    RunQueue& readyVec = workers[thread->worker]->readyVec;
+    if(readyVec.contains(thread)){
+        readyVec.remove(thread);
+        thread->weight = weight;
+        readyVec.push(thread);
+        return 0;
+    }
+    thread->weight = weight;
+    return 0;
+}
+
+/**
+ * @return true if a READY thread of the calling worker has a higher priority than the running one. the deques of more
+ * than one worker have no priorities, so then it is always false.
+ */
+bool Scheduler::should_preempt() const {
+    if(stealing){
+        return false;
+    }
+    Worker* worker = self();
+    if(worker->running && is_idle(worker->running)){
+        return !worker->readyVec.empty();
+    }
+    return worker->running && worker->readyVec.top_priority() < worker->running->priority;
+}
+
+/**
+ * get the thread out of the sleep heap and add it to the ready queue if it is not blocked
+ * @param tid
+ * @return 0 upon success
+ *         -1 otherwise
+ */
+int Scheduler::exit_sleep(int tid) {
+    if(tid < 0 || !allThreads[tid].is_sleep){
+        return -1;
+    }
+    remove_sleeper(&allThreads[tid]);
+    Thread* thread = &allThreads[tid];
+    bool pushed = false;
+    lock_thread(thread, stealing);
+    thread->is_sleep = false;
+    if(thread->status != BLOCKED){
+        TRACE(tid, thread->status, READY, TRACE_WAKE);
+        pushed = enqueue(thread);
+    }
+    unlock_thread(thread, stealing);
+    if(pushed){
+        kick_idle_worker();
+    }
+    return 0;
+}
+
+/**
+ * wakes every thread whose wake quantum or deadline was reached.
+ * only the threads that are due are touched, the rest of the sleepers stay in the heaps.
+ */
+void Scheduler::wake_sleepers() {
+    while(!sleepHeap.empty() && sleepHeap.top_key() <= quantum){
+        exit_sleep(sleepHeap.top()->tid);
+    }
+    if(timedHeap.empty()){
+        return;
+    }
+    long now = now_us();
+    while(!timedHeap.empty() && timedHeap.top_key() <= now){
+        exit_sleep(timedHeap.top()->tid);
+    }
+}
+
+/**
+ * @return the index of an empty wait queue, reusing the queues that were freed
+ */
+int Scheduler::new_wait_queue() {
+    if(!freeWaitQueues.empty()){
+        int queue = freeWaitQueues.back();
+        freeWaitQueues.pop_back();
+        return queue;
+    }
+    waitQueues.emplace_back();
+    return (int) waitQueues.size() - 1;
+}
+
+void Scheduler::free_wait_queue(int queue) {
+    freeWaitQueues.push_back(queue);
+}
+
+int Scheduler::wait_queue_empty(int queue) const {
+    return waitQueues[queue].empty();
+}
+
+/**
+ * blocks the running thread at the end of the queue and schedules the next thread
+ * @param queue
+ */
+void Scheduler::park(ThreadQueue& queue) {
+    lock_thread(running(), stealing);
+    running()->status = BLOCKED;
+    unlock_thread(running(), stealing);
+    queue.push(running());
+    schedule();
+}
+
+/**
+ * moves the first thread of the queue to the ready queue
+ * @param queue
+ * @return the thread that was woken, nullptr if the queue is empty
+ */
+Thread* Scheduler::unpark(ThreadQueue& queue) {
+    Thread* thread = queue.pop();
+    if(thread){
+        TRACE(thread->tid, BLOCKED, READY, TRACE_UNPARK);
+        make_ready(thread);
+    }
+    return thread;
+}
+
+/**
+ * moves a thread from the middle of its wait queue to the ready queue
+ * @param thread
+ */
+void Scheduler::unpark(Thread& thread) {
+    thread.queue->remove(&thread);
+    TRACE(thread.tid, BLOCKED, READY, TRACE_UNPARK);
+    make_ready(&thread);
+}
+
+void Scheduler::park(int queue) {
+    park(waitQueues[queue]);
+}
+
+Thread* Scheduler::unpark(int queue) {
+    return unpark(waitQueues[queue]);
+}
+
+Thread* Scheduler::waiter(int queue) const {
+    return waitQueues[queue].front();
+}
+
+/**
+ * the thread is taken out of the queue and set RUNNING on the calling worker without going through the ready queue.
+ * with more than one worker the running thread is published as READY by finish_switch, once its context is saved.
+ * @param queue
+ */
+void Scheduler::hand_off(int queue) {
+    Worker* worker = self();
+    Thread* thread = running();
+    Thread* next = waitQueues[queue].pop();
+    TRACE(next->tid, BLOCKED, READY, TRACE_UNPARK);
+    lock_thread(next, stealing);
+    next->status = RUNNING;
+    next->on_cpu = stealing;
+    next->worker = worker->index;
+    unlock_thread(next, stealing);
+    if(stealing){
+        worker->prev = thread;
+    }else{
+        make_ready(thread);
+    }
+    set_running(worker, next);
+}
+
+/**
+ * blocks the running thread until thread terminates
+ * @param thread
+ */
+void Scheduler::wait_for(Thread* thread) {
+    park(thread->joiners);
+}
+
+/**
+ * arms fd in the epoll set for the directions its threads wait for, plus events. the registration is one-shot, so a
+ * file descriptor that stays ready does not keep reporting until its threads retried their I/O.
+ * @param fd
+ * @param events
+ * @return 0 on success -1 otherwise
+ */
+int Scheduler::arm(int fd, uint32_t events) {
+    IoWait& io = ioWaits[fd];
+    struct epoll_event event = {};
+    event.events = events | EPOLLONESHOT;
+    if(!io.readers.empty()){
+        event.events |= EPOLLIN;
+    }
+    if(!io.writers.empty()){
+        event.events |= EPOLLOUT;
+    }
+    event.data.fd = fd;
+    if(epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event) == -1){
+        if(errno != ENOENT || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1){
+            return -1;
+        }
+    }
+    if(!io.armed){
+        io.armed = true;
+        __atomic_add_fetch(&io_armed, 1, __ATOMIC_RELAXED);
+    }
+    return 0;
+}
+
+/**
+ * called when a waiter of fd left its queue without being woken. if it was the last one, fd leaves the epoll set, so
+ * it no longer counts as armed and the workers do not poll for it. otherwise it is armed for the directions that
+ * threads still wait for.
+ * @param fd
+ */
+void Scheduler::disarm(int fd) {
+    IoWait& io = ioWaits[fd];
+    if(!io.armed){
+        return; // its event was taken, poll_io arms it again if threads still wait
+    }
+    if(!io.readers.empty() || !io.writers.empty()){
+        arm(fd, 0);
+        return;
+    }
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr); // fails if fd was closed, which took it out of the set already
+    io.armed = false;
+    __atomic_sub_fetch(&io_armed, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * creates the epoll set if no thread waited for I/O yet
+ * @return 0 on success -1 otherwise
+ */
+int Scheduler::open_epoll() {
+    if(epoll_fd != -1){
+        return 0;
+    }
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if(epoll_fd == -1){
+        fprintf(stderr, SYSTEM_CALL_ERROR "epoll_create1 error\n");
+        return -1;
+    }
+    return 0;
+}
+
+int Scheduler::park_io(int fd, uint32_t events) {
+    if(open_epoll() == -1){
+        return -1;
+    }
+    if((size_t) fd >= ioWaits.size()){
+        ioWaits.resize(fd + 1);
+    }
+    if(arm(fd, events) == -1){
+        return -1;
+    }
+    running()->io_fd = fd;
+    park(events & EPOLLIN ? ioWaits[fd].readers : ioWaits[fd].writers);
+    return 0;
+}
+
+/**
+ * waits on the epoll set for up to timeout_us microseconds. epoll_pwait2 (Linux 5.11) takes the timeout in
+ * nanoseconds, older kernels only have epoll_wait, and the timeout is rounded up to a millisecond.
+ */
+static int wait_events(int epoll_fd, struct epoll_event* events, long timeout_us){
+#ifdef SYS_epoll_pwait2
+    static bool has_pwait2 = true;
+    if(timeout_us > 0 && timeout_us % 1000 != 0 && has_pwait2){
+        struct timespec timeout;
+        timeout.tv_sec = timeout_us / 1000000;
+        timeout.tv_nsec = (timeout_us % 1000000) * 1000;
+        int count = (int) syscall(SYS_epoll_pwait2, epoll_fd, events, IO_EVENTS, &timeout, nullptr, 0);
+        if(count != -1 || errno != ENOSYS){
+            return count;
+        }
+        has_pwait2 = false;
+    }
+#endif
+    long timeout_ms = timeout_us <= 0 ? timeout_us : (timeout_us + 999) / 1000;
+    return epoll_wait(epoll_fd, events, IO_EVENTS, timeout_ms > INT_MAX ? INT_MAX : (int) timeout_ms);
+}
+
+/**
+ * every thread waiting on a ready file descriptor is woken, since one of them may not use up what is ready.
+ * a file descriptor that still has threads waiting in the other direction is armed again.
+ * completions of the io_uring engine are read from the ring without a system call, and before waiting the queued
+ * operations are submitted so the wait can end.
+ */
+int Scheduler::poll_io(long timeout_us) {
+    if(!io_waiting()){
+        return 0;
+    }
+    if(timeout_us != 0){
+        submit_io();
+    }
+    int completed = reap_ring();
+    if(completed > 0){
+        timeout_us = 0;
+    }
+    if(timeout_us == 0 && !__atomic_load_n(&io_armed, __ATOMIC_RELAXED)){
+        return completed;
+    }
+    struct epoll_event events[IO_EVENTS];
+    int count = wait_events(epoll_fd, events, timeout_us);
+    for(int i = 0; i < count; i ++){
+        if(events[i].data.fd == ring.fd()){
+            reap_ring();
+            continue;
+        }
+        IoWait& io = ioWaits[events[i].data.fd];
+        io.armed = false;
+        __atomic_sub_fetch(&io_armed, 1, __ATOMIC_RELAXED);
+        if(events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)){
+            while(unpark(io.readers)){
+            }
+        }
+        if(events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)){
+            while(unpark(io.writers)){
+            }
+        }
+        if(!io.readers.empty() || !io.writers.empty()){
+            arm(events[i].data.fd, 0);
+        }
+    }
+    return count;
+}
+
+bool Scheduler::io_waiting() const {
+    return __atomic_load_n(&io_armed, __ATOMIC_RELAXED) != 0 || ring.busy();
+}
+
+int Scheduler::setup_ring(unsigned entries) {
+    if(ring.setup(entries) == -1 || open_epoll() == -1){
+        return -1;
+    }
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = ring.fd();
+    if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ring.fd(), &event) == -1){
+        return -1;
+    }
+    ring_enabled = true;
+    return 0;
+}
+
+bool Scheduler::uses_ring() const {
+    return ring_enabled;
+}
+
+/**
+ * the completion carries the tid and a sequence number, so a completion that arrives after its thread was terminated
+ * is not mistaken for one of a new thread with the same tid
+ */
+int Scheduler::queue_io(uint8_t op, int fd, void* buf, unsigned len) {
+    Thread* thread = running();
+    if(++next_io_seq == 0){
+        next_io_seq = 1;
+    }
+    if(ring.queue(op, fd, buf, len, ((uint64_t) next_io_seq << 32) | (uint32_t) thread->tid) == -1){
+        return -1;
+    }
+    thread->io_seq = next_io_seq;
+    return 0;
+}
+
+void Scheduler::park_ring() {
+    park(ringWaiters);
+}
+
+void Scheduler::submit_io() {
+    if(ring.submit() == -1){
+        fprintf(stderr, SYSTEM_CALL_ERROR "io_uring_enter error\n");
+    }
+}
+
+bool Scheduler::io_queued() const {
+    return ring.pending();
+}
+
+/**
+ * hands every completion to its thread and moves the thread to the ready queue if it is parked waiting for it.
+ * a completion whose thread was terminated releases the stack the thread left behind.
+ * @return the number of completions
+ */
+int Scheduler::reap_ring() {
+    IoCompletion completions[IO_EVENTS];
+    int total = 0;
+    int count;
+    while((count = ring.reap(completions, IO_EVENTS)) > 0){
+        for(int i = 0; i < count; i ++){
+            int tid = (int) (uint32_t) completions[i].data;
+            unsigned seq = (unsigned) (completions[i].data >> 32);
+            Thread* thread = find(tid);
+            if(thread && thread->io_seq == seq){
+                thread->io_seq = 0;
+                thread->io_result = completions[i].result;
+                if(thread->queue == &ringWaiters){
+                    unpark(*thread);
+                }
+                continue;
+            }
+            for(size_t j = 0; j < orphanStacks.size(); j ++){
+                if(orphanStacks[j].data == completions[i].data){
+                    stackPool.release(orphanStacks[j].stack, orphanStacks[j].size);
+                    orphanStacks[j] = orphanStacks.back();
+                    orphanStacks.pop_back();
+                    break;
+                }
+            }
+        }
+        total += count;
+    }
+    return total;
+}
+
+/**
+ * @return the total quantum at which the next sleeper wakes up, -1 if no thread is sleeping
+ */
+long Scheduler::next_wake() const {
+    return sleepHeap.empty() ? -1 : sleepHeap.top_key();
+}
+
+long Scheduler::next_wake_us() const {
+    return timedHeap.empty() ? -1 : timedHeap.top_key();
+}
+
+long Scheduler::now_us() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000L + now.tv_nsec / 1000;
+}
+
+ThreadHeap::ThreadHeap(long Thread::*key, int Thread::*index) : key(key), index(index)
+{
+}
+
+void ThreadHeap::reserve(int size)
+{
+    heap.reserve(size);
+}
+
+int ThreadHeap::empty() const
+{
+    return heap.empty();
+}
+
+Thread* ThreadHeap::top() const
+{
+    return heap.front().thread;
+}
+
+long ThreadHeap::top_key() const
+{
+    return heap.front().key;
+}
+
+void ThreadHeap::swap(int i, int j)
+{
+    HeapEntry temp = heap[i];
+    heap[i] = heap[j];
+    heap[j] = temp;
+    heap[i].thread->*index = i;
+    heap[j].thread->*index = j;
+}
+
+void ThreadHeap::sift_up(int i)
+{
+    while(i > 0 && heap[i].key < heap[(i - 1) / 2].key){
+        swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+void ThreadHeap::sift_down(int i)
+{
+    int size = (int) heap.size();
+    while(true){
+        int smallest = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+        if(left < size && heap[left].key < heap[smallest].key){
+            smallest = left;
+        }
+        if(right < size && heap[right].key < heap[smallest].key){
+            smallest = right;
+        }
+        if(smallest == i){
+            return;
+        }
+        swap(i, smallest);
+        i = smallest;
+    }
+}
+
+void ThreadHeap::push(Thread* thread)
+{
+    thread->*index = (int) heap.size();
+    heap.push_back({thread->*key, thread});
+    sift_up(thread->*index);
+}
+
+/**
+ * removes the thread from wherever it is in the heap by moving the last thread into its place
+ * @param thread
+ */
+void ThreadHeap::remove(Thread* thread)
+{
+    int i = thread->*index;
+    if(i < 0){
+        return;
+    }
+    int last = (int) heap.size() - 1;
+    if(i != last){
+        swap(i, last);
+    }
+    heap.pop_back();
+    thread->*index = -1;
+    if(i < last){
+        sift_down(i);
+        sift_up(i);
+    }
+}
+
+RunQueue::RunQueue(int policy, int max_threads) :
+        fair(policy == UTHREAD_SCHED_FAIR), passHeap(&Thread::pass, &Thread::run_index)
+{
+    if(fair){
+        passHeap.reserve(max_threads);
+    }
+}
+
+int RunQueue::empty() const
+{
+    return fair ? passHeap.empty() : nonEmpty == 0;
+}
+
+/**
+ * @return the level whose queue the thread is linked into, -1 if it is in none of the levels. the queue is compared
+ * with std::less before it is subtracted, since it may be a wait queue outside levels, and subtracting pointers into
+ * different arrays is undefined.
+ */
+int RunQueue::level_of(const Thread* thread) const
+{
+    std::less<const ThreadQueue*> before;
+    if(!thread->queue || before(thread->queue, levels) || !before(thread->queue, levels + UTHREAD_PRIORITY_LEVELS)){
+        return -1;
+    }
+    return (int) (thread->queue - levels);
+}
+
+bool RunQueue::contains(const Thread* thread) const
+{
+    if(fair){
+        return thread->run_index != -1;
+    }
+    return level_of(thread) != -1;
+}
+
+/**
+ * the fair policy has no priorities, so it never asks for an immediate preemption
+ */
+int RunQueue::top_priority() const
+{
+    if(fair){
+        return UTHREAD_PRIORITY_LEVELS;
+    }
+    return nonEmpty ? __builtin_ctz(nonEmpty) : UTHREAD_PRIORITY_LEVELS;
+}
+
+/**
+ * under the fair policy a thread that was away (asleep, blocked or new) starts from the current virtual time, so it
+ * can not make up for the time it did not run by taking the CPU for a long while.
+ * @param thread
+ */
+void RunQueue::push(Thread* thread)
+{
+    if(fair){
+        if(thread->pass < virtual_time){
+            thread->pass = virtual_time;
+        }
+        passHeap.push(thread);
+        return;
+    }
+    levels[thread->priority].push(thread);
+    nonEmpty |= 1U << thread->priority;
+}
+
+/**
+ * under the fair policy the thread pays for its turn when it is picked
+ * @return the next thread to run, nullptr if there is none
+ */
+Thread* RunQueue::pop()
+{
+    if(fair){
+        if(passHeap.empty()){
+            return nullptr;
+        }
+        Thread* thread = passHeap.top();
+        passHeap.remove(thread);
+        virtual_time = thread->pass;
+        thread->pass += (long) thread->slice * STRIDE_UNIT / thread->weight;
+        return thread;
+    }
+    if(!nonEmpty){
+        return nullptr;
+    }
+    int level = __builtin_ctz(nonEmpty);
+    Thread* thread = levels[level].pop();
+    if(levels[level].empty()){
+        nonEmpty &= ~(1U << level);
+    }
+    return thread;
+}
+
+/**
+ * unlinks the thread if it is in one of the levels, otherwise does nothing
+ * @param thread
+ */
+void RunQueue::remove(Thread* thread)
+{
+    if(fair){
+        passHeap.remove(thread);
+        return;
+    }
+    int level = level_of(thread);
+    if(level == -1){
+        return;
+    }
+    levels[level].remove(thread);
+    if(levels[level].empty()){
+        nonEmpty &= ~(1U << level);
+    }
+}
+
+int ThreadQueue::empty() const
+{
+    return head == nullptr;
+}
+
+Thread* ThreadQueue::front() const
+{
+    return head;
+}
+
+void ThreadQueue::push(Thread* thread)
+{
+    if(thread->queue){
+        thread->queue->remove(thread);
+    }
+    thread->queue = this;
+    thread->next = nullptr;
+    thread->prev = tail;
+    if(tail){
+        tail->next = thread;
+    }else{
+        head = thread;
+    }
+    tail = thread;
+}
+
+Thread* ThreadQueue::pop()
+{
+    Thread* thread = head;
+    if(thread){
+        remove(thread);
+    }
+    return thread;
+}
+
+/**
+ * unlinks the thread if it is in this queue, otherwise does nothing
+ * @param thread
+ */
+void ThreadQueue::remove(Thread* thread)
+{
+    if(thread->queue != this){
+        return;
+    }
+    if(thread->prev){
+        thread->prev->next = thread->next;
+    }else{
+        head = thread->next;
+    }
+    if(thread->next){
+        thread->next->prev = thread->prev;
+    }else{
+        tail = thread->prev;
+    }
+    thread->next = nullptr;
+    thread->prev = nullptr;
+    thread->queue = nullptr;
+}
@@ -1,67 +1,483 @@
 //
 // Created by yousefak on 4/19/23.
 //
+#include <cstddef>
+#include <cstdint>
 #include <cstdlib>
-#include <queue>
+#include <deque>
+#include <vector>
 #include <sys/time.h>
+#include <sys/types.h>
+#include "tid_bitmap.h"
+#include "stack_pool.h"
+#include "chunked_array.h"
+#include "work_deque.h"
+#include "io_ring.h"
+#include "thread_stats.h"
+#include "uthreads.h"
 
 #ifndef UTHREADS_H_SCHEDULER_H
 #define UTHREADS_H_SCHEDULER_H
 
-enum Status {RUNNING, READY, BLOCKED};
+enum Status {RUNNING, READY, BLOCKED, ZOMBIE};
 
 typedef void (*thread_entry_point)();
 
-typedef struct Thread{
+struct Thread;
+
+/**
+ * FIFO queue of threads linked through the next/prev fields embedded in Thread.
+ * push, pop and removing a thread from the middle are O(1) and never allocate.
+ * a thread can be linked into one queue at a time.
+ */
+class ThreadQueue{
+    Thread* head = nullptr;
+    Thread* tail = nullptr;
+public :
+    int empty() const;
+
+    Thread* front() const;
+
+    void push(Thread* thread);
+
+    Thread* pop();
+
+    void remove(Thread* thread);
+};
+
+#define THREAD_LINE 64 // every Thread starts on a cache line of its own
+
+/**
+ * the fields a switch reads and writes come first and fill the first cache line of the thread, so switching a thread
+ * in or out touches as few of its cache lines as possible. the fields of the fair run queue and of the sleep heaps
+ * follow, and those that are only used to spawn, join and terminate a thread come last.
+ */
+typedef struct alignas(THREAD_LINE) Thread{
     int tid = -1;
     Status status = READY;
+    int lock = 0; // with more than one worker, guards status, is_sleep and on_cpu against the workers that do not
+                  // hold the library lock
+    int worker = 0; // the worker that ran the thread last
+    bool on_cpu = false; // some worker runs the thread, or has not finished switching away from it
+    bool cancel = false; // terminated by another worker while it was running, it terminates at its next preemption
+    bool is_sleep = false;
+    int priority = UTHREAD_DEFAULT_PRIORITY;
+    int slice = 1; // length of a turn in quantums
     long quantum = 0;
-    int sleep = 0;
-    bool is_sleep;
-    char* stack;
-    thread_entry_point *entry_point = nullptr;
+    struct Thread* next = nullptr; // links of the queue the thread is waiting in
+    struct Thread* prev = nullptr;
+    ThreadQueue* queue = nullptr; // the run or wait queue the thread is linked into, nullptr when it is in none
+    int weight = UTHREAD_DEFAULT_WEIGHT;
+    int run_index = -1; // position in the fair run queue, -1 when not in it
+    long pass = 0; // stride scheduling virtual time, the fair run queue runs the smallest one first
+    long wake = 0; // the total quantum at which a sleeping thread becomes ready again
+    long wake_us = 0; // the CLOCK_MONOTONIC time (in microseconds) at which a thread put to sleep by uthread_sleep_us
+                      // becomes ready again
+    int heap_index = -1; // position in the sleep heap, -1 when not sleeping
+    int timed_index = -1; // position in the timed sleep heap, -1 when not sleeping there
+    unsigned io_seq = 0; // the io_uring operation the thread waits for, 0 when none is in flight
+    int io_result = 0; // result of the last io_uring operation of the thread
+    int io_fd = -1; // the file descriptor the thread last waited on in the epoll set
+    bool detached = true; // a detached thread is released as soon as it terminates, instead of becoming a ZOMBIE
+    void* chan_data = nullptr; // the message a thread waiting on a channel sends, or where the one it receives goes,
+                               // nullptr once the thread that woke it copied it
+    char* stack = nullptr;
+    size_t stack_size = 0;
+    thread_entry_point entry_point = nullptr;
+    uthread_start_routine start_routine = nullptr; // set for threads made by uthread_create
+    void* arg = nullptr;
+    void* retval = nullptr; // what a ZOMBIE thread returned, until it is joined
+    ThreadQueue joiners; // threads waiting for this one to terminate
 }Thread;
 
-using vec = std::queue<Thread*>;
+static_assert(offsetof(Thread, weight) <= THREAD_LINE, "the fields of a switch fit in the first cache line");
+static_assert(sizeof(Thread) == 3 * THREAD_LINE, "a Thread fills three cache lines, with no line of padding");
+
+/**
+ * an entry of a ThreadHeap, a copy of the key of the thread next to it
+ */
+struct HeapEntry{
+    long key;
+    Thread* thread;
+};
+
+/**
+ * binary min-heap of threads ordered by one of their fields.
+ * every thread keeps its own position in the heap, so it can be removed from the middle in O(log n).
+ * the keys are copied into the heap when a thread is pushed, so sifting compares entries of one contiguous array and
+ * only touches the threads it moves. the key of a thread must not change while it is in the heap.
+ */
+class ThreadHeap{
+    std::vector<HeapEntry> heap;
+    long Thread::*key;
+    int Thread::*index;
+
+    void swap(int i, int j);
+    void sift_up(int i);
+    void sift_down(int i);
+public :
+    ThreadHeap(long Thread::*key, int Thread::*index);
+
+    void reserve(int size);
+
+    int empty() const;
+
+    Thread* top() const;
+
+    /**
+     * @return the key of the top thread, read from the heap without touching the thread
+     */
+    long top_key() const;
+
+    void push(Thread* thread);
+
+    void remove(Thread* thread);
+};
+
+/**
+ * READY threads.
+ * under UTHREAD_SCHED_PRIORITY: one FIFO queue per priority level, with a bitmap of the levels that are not empty.
+ * the next thread comes from the lowest set bit (the highest priority), found with __builtin_ctz, so picking the next
+ * thread is O(1) no matter how many threads or levels there are.
+ * under UTHREAD_SCHED_FAIR: stride scheduling, a heap ordered by pass. the thread with the smallest pass runs next and
+ * its pass grows by slice * STRIDE_UNIT / weight, so threads run in proportion to their weights.
+ */
+class RunQueue{
+    ThreadQueue levels[UTHREAD_PRIORITY_LEVELS];
+    uint32_t nonEmpty = 0;
+    bool fair;
+    ThreadHeap passHeap;
+    long virtual_time = 0; // pass of the last thread that was picked
+
+    int level_of(const Thread* thread) const;
+public :
+    /**
+     * @param max_threads the most threads that can be READY at once, the heap of the fair policy is reserved for them
+     * up front since threads are pushed from the timer signal handler, where allocating is not safe
+     */
+    RunQueue(int policy, int max_threads);
+
+    int empty() const;
+
+    /**
+     * @return true if the thread is waiting in this run queue
+     */
+    bool contains(const Thread* thread) const;
+
+    /**
+     * @return the highest priority that has a READY thread, UTHREAD_PRIORITY_LEVELS if there is none
+     */
+    int top_priority() const;
+
+    void push(Thread* thread);
+
+    Thread* pop();
+
+    void remove(Thread* thread);
+};
+
+/**
+ * a kernel thread that runs uthreads.
+ * a single worker keeps its READY threads in readyVec. with more than one worker every worker keeps them in its own
+ * work-stealing deque instead, and a worker with nothing to run steals from the others or runs its idle thread.
+ */
+struct Worker{
+    int index;
+    pid_t kernel_tid = 0;
+    Thread* running = nullptr;
+    Thread* prev = nullptr; // the thread switched away from, published by finish_switch once its context is saved
+    bool kicked = false; // the idle thread was sent a signal to look for work
+    bool preempted = false; // the running thread is being preempted, it did not give up the CPU itself
+    bool holding_lock = false; // the worker holds the library lock of uthreads.cpp
+    int missed_ticks = 0; // timer expirations that started no quantum, counted at the next switch
+    int armed_slice = 1; // slice of the interval the timer is set to, 0 while it is set to fire once
+    timer_t timer; // timer of the worker, used instead of an interval timer when the library uses a posix timer
+    RunQueue readyVec;
+    WorkDeque deque;
+    Thread idle;
+
+    Worker(int index, int policy, int max_threads);
+
+    /**
+     * idle is an aligned Thread, and new does not honor that alignment before C++17
+     */
+    static void* operator new(size_t size);
+
+    static void operator delete(void* memory);
+};
+
+/**
+ * the threads parked on a file descriptor until it is ready for reading or writing
+ */
+struct IoWait{
+    ThreadQueue readers;
+    ThreadQueue writers;
+    bool armed = false; // registered in the epoll set and did not fire yet
+};
+
+/**
+ * the stack of a thread that was terminated while an io_uring operation on it was in flight. the kernel may still
+ * write to it, so it is only released when the operation completes.
+ */
+struct OrphanStack{
+    uint64_t data;
+    char* stack;
+    size_t size;
+};
 
 class Scheduler{
 
-    int max_stack_size;
-    vec readyVec;
-    vec sleepVec;
+    int max_threads;
+    size_t default_stack_size;
+    std::vector<Worker*> workers;
+    bool stealing; // more than one worker, the READY threads are in the deques of the workers
+    int idle_workers = 0;
+    long wake_hint = -1; // next_wake, readable without the library lock
+    long timed_hint = -1; // next_wake_us, readable without the library lock
+    ThreadHeap sleepHeap;
+    ThreadHeap timedHeap; // threads sleeping until a CLOCK_MONOTONIC deadline
+    TidBitmap freeTids;
+    StackPool stackPool;
+    std::deque<ThreadQueue> waitQueues; // deque, so the queues do not move when more are added
+    std::vector<int> freeWaitQueues;
+    int epoll_fd = -1; // created when the first thread waits for I/O
+    int io_armed = 0; // file descriptors armed in the epoll set
+    std::deque<IoWait> ioWaits; // indexed by file descriptor, deque so the queues do not move when it grows
+    IoRing ring;
+    bool ring_enabled = false;
+    ThreadQueue ringWaiters; // threads waiting for their io_uring operation
+    unsigned next_io_seq = 0;
+    std::vector<OrphanStack> orphanStacks;
+    StatsTable stats;
+    uthread_stats retired = {}; // statistics of the threads that terminated
 
     void removeFromReadyVec(int tid);
+
+    bool enqueue(Thread* thread);
+
+    void make_ready(Thread* thread);
+
+    int preempt_stealing();
+
+    bool claim(Thread* thread);
+
+    Thread* pick(bool fifo);
+
+    void set_running(Worker* worker, Thread* next);
+
+    void account_switch(Worker* worker, Thread* prev, Thread* next);
+
+    void account_ready(Thread* thread);
+
+    void kick_idle_worker();
+
+    void update_wake_hint();
+
+    void remove_sleeper(Thread* thread);
+
+    int start_sleep(Thread* thread, ThreadHeap& heap);
+
+    void park(ThreadQueue& queue);
+
+    Thread* unpark(ThreadQueue& queue);
+
+    void unpark(Thread& thread);
+
+    int arm(int fd, uint32_t events);
+
+    void disarm(int fd);
+
+    int open_epoll();
+
+    int reap_ring();
 public :
 
     int quantum = 0;
 
+    /**
+     * @return the worker of the calling kernel thread
+     */
+    static Worker* self();
+
+    /**
+     * makes the calling kernel thread the worker with this index, running its idle thread unless it is worker 0
+     * @param index
+     */
+    void enter_worker(int index);
+
+    Thread* running() const;
+
+    /**
+     * @return true if some worker is running the thread right now
+     */
+    bool on_cpu(const Thread* thread) const;
+
+    bool is_idle(const Thread* thread) const;
+
+    /**
+     * publishes the thread the calling worker switched away from. called right after every switch, by the thread
+     * that was switched in.
+     */
+    void finish_switch();
+
+    /**
+     * keeps the other workers from picking the thread up, before it is terminated
+     * @return false if a worker runs the thread right now, it is then marked to terminate at its next preemption
+     */
+    bool stop(Thread* thread);
+
+    /**
+     * @return true if a sleeper is due, read without the library lock
+     */
+    bool sleepers_due() const;
+
+    int get_new_tid() const;
+
+    int thread_limit() const;
+
+    Thread* find(int tid) const;
+
+    Thread* find_any(int tid) const;
+
     int is_readyVec_empty();
 
+    int set_priority(int tid, int priority);
+
+    int set_weight(int tid, int weight);
+
+    bool should_preempt() const;
+
     int sleep(int tid, int sleep_quantum);
 
+    /**
+     * puts the thread to sleep until the CLOCK_MONOTONIC time deadline, in microseconds
+     * @return 0 upon success -1 otherwise
+     */
+    int sleep_until(int tid, long deadline);
+
     int exit_sleep(int tid);
 
-    struct Thread * running;
+    void wake_sleepers();
+
+    long next_wake() const;
+
+    /**
+     * @return the CLOCK_MONOTONIC time (in microseconds) at which the next timed sleeper wakes up, -1 if there is none
+     */
+    long next_wake_us() const;
+
+    /**
+     * @return the CLOCK_MONOTONIC time in microseconds, the clock of the uthread_sleep_us deadlines
+     */
+    static long now_us();
+
+    int new_wait_queue();
+
+    void free_wait_queue(int queue);
+
+    int wait_queue_empty(int queue) const;
+
+    void park(int queue);
+
+    Thread* unpark(int queue);
+
+    /**
+     * @return the thread that waited the longest in the queue, nullptr if the queue is empty
+     */
+    Thread* waiter(int queue) const;
+
+    /**
+     * switches the calling worker straight to the first thread of the queue, which must not be empty. the running
+     * thread becomes READY as if it yielded, and the threads in the ready queue wait for their turn.
+     */
+    void hand_off(int queue);
+
+    void wait_for(Thread* thread);
 
-    struct Thread* allThreads;
+    /**
+     * blocks the running thread until fd is ready for events (EPOLLIN or EPOLLOUT) and schedules the next thread
+     * @return 0 on success, -1 if fd could not be added to the epoll set
+     */
+    int park_io(int fd, uint32_t events);
 
-    Scheduler(int max_size, int max_stack_size);
+    /**
+     * moves the threads whose file descriptor is ready to the ready queue
+     * @param timeout_us how long to wait for a file descriptor in microseconds, 0 to only check, -1 without a limit
+     * @return the number of ready file descriptors, -1 on failure
+     */
+    int poll_io(long timeout_us);
+
+    /**
+     * @return true if some file descriptor is armed or some io_uring operation is in flight, read without the library
+     * lock
+     */
+    bool io_waiting() const;
+
+    /**
+     * sets up the io_uring engine, and watches the ring in the epoll set so a wait for I/O also ends on a completion
+     * @param entries size of the submission ring
+     * @return 0 on success, -1 if io_uring is not available and the poll path is used instead
+     */
+    int setup_ring(unsigned entries);
+
+    bool uses_ring() const;
+
+    /**
+     * queues an io_uring operation for the running thread, it is submitted with the next round
+     * @return 0 on success, -1 if the ring is full
+     */
+    int queue_io(uint8_t op, int fd, void* buf, unsigned len);
+
+    /**
+     * blocks the running thread until its io_uring operation completes and schedules the next thread
+     */
+    void park_ring();
+
+    /**
+     * submits the io_uring operations queued since the last round, with one system call
+     */
+    void submit_io();
+
+    /**
+     * @return true if io_uring operations are waiting to be submitted, read without the library lock
+     */
+    bool io_queued() const;
+
+    void reap(int tid);
+
+    /**
+     * fills out with the statistics of tid, including a ZOMBIE thread
+     * @return 0 on success, -1 if no such thread exists or no statistics are kept
+     */
+    int get_stats(int tid, uthread_stats* out) const;
+
+    /**
+     * fills out with the sum of the statistics of the threads that exist and of those that terminated
+     */
+    void get_process_stats(uthread_stats* out) const;
+
+    ChunkedArray<Thread> allThreads;
+
+    Scheduler(int max_size, size_t max_stack_size, int policy, int worker_count);
 
     int schedule();
 
-    int preempt();
+    /**
+     * @param yielded the running thread gives up the CPU itself, it is not preempted
+     */
+    int preempt(bool yielded);
 
     int block(int tid);
 
     int resume(int tid);
 
-    int spawn(int tid, thread_entry_point * entry_point);
+    int spawn(int tid, thread_entry_point entry_point, size_t stack_size, int priority);
+
+    void start(int tid);
 
     int terminate(int tid);
 
     ~Scheduler();
-
-    void remove_from_sleepVec(int tid);
 };
 
 /**
@@ -0,0 +1,118 @@
+#include <csignal>
+#include <cstdio>
+#include <sys/auxv.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "stack_pool.h"
+
+#define HANDLER_FRAMES 4096 /* timer_handler down to the context switch */
+#define SLAB_STACKS 16 /* stacks mapped together when a free list runs out */
+
+/**
+ * @return the size of the frame the kernel pushes when it delivers a signal on this machine
+ */
+static size_t signal_frame_size()
+{
+#ifdef AT_MINSIGSTKSZ
+    size_t size = getauxval(AT_MINSIGSTKSZ);
+    if(size > (size_t) MINSIGSTKSZ){
+        return size;
+    }
+#endif
+    return MINSIGSTKSZ;
+}
+
+/**
+ * every guard page splits a mapping in two, so guarded stacks use up the kernel's vm.max_map_count. only a quarter of
+ * it is spent on guards, the rest is left for malloc and the application.
+ * @return how many stacks may get a guard page
+ */
+static size_t guard_budget()
+{
+    long max_map_count = 65530;
+    FILE* file = fopen("/proc/sys/vm/max_map_count", "r");
+    if(file){
+        if(fscanf(file, "%ld", &max_map_count) != 1){
+            max_map_count = 65530;
+        }
+        fclose(file);
+    }
+    return max_map_count / 4;
+}
+
+static size_t page_size()
+{
+    return (size_t) sysconf(_SC_PAGESIZE);
+}
+
+size_t StackPool::stack_size(size_t size)
+{
+    size_t page = page_size();
+    size += 2 * signal_frame_size() + HANDLER_FRAMES; // a timer signal may nest on the handler that switches threads
+    return (size + page - 1) / page * page;
+}
+
+/**
+ * the pool starts empty, and may give guard pages to as many stacks as guard_budget allows
+ */
+StackPool::StackPool() : guards(0), guard_limit(guard_budget())
+{
+}
+
+/**
+ * unmaps every stack, except the slab we are running on when a thread other than main terminates the process
+ */
+StackPool::~StackPool()
+{
+    char here;
+    for(auto& mapping : mappings){
+        if(&here >= mapping.first && &here < mapping.first + mapping.second){
+            continue;
+        }
+        munmap(mapping.first, mapping.second);
+    }
+}
+
+/**
+ * pops a stack of the given size from its free list. when the list is empty a slab of SLAB_STACKS stacks is mapped
+ * at once, each with a guard page below it.
+ * once the guard budget is spent the stacks are still handed out, without guards, so the thread limit is not capped by
+ * the kernel's mapping limit.
+ * @param size
+ * @return the lowest usable address of the stack, nullptr if mapping a slab failed
+ */
+char* StackPool::acquire(size_t size)
+{
+    std::vector<char*>& stacks = freeStacks[size];
+    if(stacks.empty()){
+        size_t page = page_size();
+        size_t length = (page + size) * SLAB_STACKS;
+        void* map = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+        if(map == MAP_FAILED){
+            return nullptr;
+        }
+        mappings.push_back(std::make_pair((char*) map, length));
+        for(int i = SLAB_STACKS - 1; i >= 0; i --){
+            char* guard = (char*) map + i * (page + size);
+            if(guards < guard_limit && mprotect(guard, page, PROT_NONE) == 0){
+                guards ++;
+            }
+            stacks.push_back(guard + page);
+        }
+    }
+    char* stack = stacks.back();
+    stacks.pop_back();
+    return stack;
+}
+
+/**
+ * puts the stack back on the free list of its size. the memory stays mapped, so a thread may still be running on it
+ * until it switches away.
+ * @param stack
+ * @param size
+ */
+void StackPool::release(char* stack, size_t size)
+{
+    freeStacks[size].push_back(stack);
+}
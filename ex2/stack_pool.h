@@ -0,0 +1,42 @@
+#ifndef UTHREADS_STACK_POOL_H
+#define UTHREADS_STACK_POOL_H
+
+#include <cstddef>
+#include <map>
+#include <utility>
+#include <vector>
+
+/**
+ * recycles thread stacks instead of going through malloc on every spawn/terminate.
+ * stacks are mapped in slabs, with a PROT_NONE guard page right below every stack, so a thread that overflows its
+ * stack faults at once instead of writing over its neighbours (up to a share of the kernel's limit on mappings, see
+ * acquire). terminated stacks go to a free list and are handed out again by the next acquire, so only the first spawn
+ * of a stack pays for the mapping.
+ */
+class StackPool{
+    std::map<size_t, std::vector<char*>> freeStacks; // free lists keyed by stack size
+    std::vector<std::pair<char*, size_t>> mappings; // slabs and their lengths
+    size_t guards;
+    size_t guard_limit;
+public :
+    StackPool();
+
+    ~StackPool();
+
+    /**
+     * @param size the bytes a thread may use itself. room for two timer signal frames is added on top, since the
+     * kernel delivers the signal on the stack of whichever thread is running, and a tick may nest on a handler.
+     * @return the size of the stack acquire hands out for a thread that asked for size bytes
+     */
+    static size_t stack_size(size_t size);
+
+    /**
+     * @param size a size returned by stack_size
+     * @return the lowest usable address of a stack of size bytes, nullptr if mapping a new one failed
+     */
+    char* acquire(size_t size);
+
+    void release(char* stack, size_t size);
+};
+
+#endif //UTHREADS_STACK_POOL_H
@@ -0,0 +1,134 @@
+//
+// test of the channels: the error paths and FIFO order of uthread_chan_t, then producers and consumers passing
+// messages through a Channel<T> of capacity 0, 1 and several messages. every message must arrive exactly once, and in
+// the order its producer sent it.
+//
+// the error cases print library errors on stderr, only a failed check makes the test exit with a nonzero status.
+//
+// usage: ./test_chan [workers]
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include "uthreads.h"
+#include "test_check.h"
+#include "channel.h"
+
+#define PRODUCERS 4
+#define CONSUMERS 3
+#define MESSAGES 20000 // messages sent by each producer
+#define STACK_BYTES 65536
+
+struct Message{
+    int producer; // -1 tells a consumer to stop
+    int seq;
+};
+
+static Channel<Message>* chan;
+static long received[PRODUCERS];
+
+static void* producer(void* arg){
+    int id = (int) (long) arg;
+    for(int seq = 0; seq < MESSAGES; seq++){
+        Message msg = {id, seq};
+        CHECK(chan->send(msg) == 0);
+        if(seq % 97 == 0){
+            uthread_yield();
+        }
+    }
+    return nullptr;
+}
+
+static void* consumer(void*){
+    int last[PRODUCERS];
+    for(int i = 0; i < PRODUCERS; i++){
+        last[i] = -1;
+    }
+    for(;;){
+        Message msg;
+        if(chan->recv(msg) != 0){
+            fail("recv failed", __FILE__, __LINE__);
+            break;
+        }
+        if(msg.producer == -1){
+            break;
+        }
+        CHECK(msg.seq > last[msg.producer]);
+        last[msg.producer] = msg.seq;
+        __atomic_add_fetch(&received[msg.producer], 1, __ATOMIC_RELAXED);
+    }
+    return nullptr;
+}
+
+static void test_raw(int workers){
+    uthread_chan_t raw;
+    CHECK(uthread_chan_init(nullptr, 1, sizeof(int)) == -1);
+    CHECK(uthread_chan_init(&raw, -1, sizeof(int)) == -1);
+    CHECK(uthread_chan_init(&raw, 1, 0) == -1);
+    CHECK(uthread_chan_init(&raw, 2, sizeof(int)) == 0);
+    int in = 7, out = 0;
+    CHECK(uthread_chan_send(&raw, nullptr) == -1);
+    CHECK(uthread_chan_recv(nullptr, &out) == -1);
+    CHECK(uthread_chan_send(&raw, &in) == 0);
+    in = 8;
+    CHECK(uthread_chan_send(&raw, &in) == 0);
+    if(workers == 1){
+        CHECK(uthread_chan_send(&raw, &in) == -1); // full, and no other thread could ever receive
+    }
+    CHECK(uthread_chan_recv(&raw, &out) == 0 && out == 7);
+    CHECK(uthread_chan_recv(&raw, &out) == 0 && out == 8);
+    if(workers == 1){
+        CHECK(uthread_chan_recv(&raw, &out) == -1); // empty, and no other thread could ever send
+    }
+    CHECK(uthread_chan_destroy(&raw) == 0);
+}
+
+static void test_mpmc(int capacity){
+    chan = new Channel<Message>(capacity);
+    CHECK(chan->ok());
+    for(int i = 0; i < PRODUCERS; i++){
+        received[i] = 0;
+    }
+    int consumers[CONSUMERS], producers[PRODUCERS];
+    for(int i = 0; i < CONSUMERS; i++){
+        consumers[i] = uthread_create(&consumer, nullptr);
+    }
+    for(long i = 0; i < PRODUCERS; i++){
+        producers[i] = uthread_create(&producer, (void*) i);
+    }
+    for(int i = 0; i < PRODUCERS; i++){
+        CHECK(uthread_join(producers[i], nullptr) == 0);
+    }
+    Message stop = {-1, 0};
+    for(int i = 0; i < CONSUMERS; i++){
+        CHECK(chan->send(stop) == 0);
+    }
+    for(int i = 0; i < CONSUMERS; i++){
+        CHECK(uthread_join(consumers[i], nullptr) == 0);
+    }
+    for(int i = 0; i < PRODUCERS; i++){
+        if(received[i] != MESSAGES){
+            fprintf(stderr, "capacity %d: %ld messages of producer %d instead of %d\n", capacity, received[i], i,
+                    MESSAGES);
+            fail("lost or duplicated messages", __FILE__, __LINE__);
+        }
+    }
+    delete chan;
+}
+
+int main(int argc, char** argv){
+    uthread_config config = {0};
+    config.workers = argc > 1 ? atoi(argv[1]) : 1;
+    config.quantum_usecs = 1000;
+    config.stack_size = STACK_BYTES;
+    if(uthread_init_ex(&config) == -1){
+        return 1;
+    }
+    test_raw(config.workers);
+    test_mpmc(0);
+    test_mpmc(1);
+    test_mpmc(16);
+    finish_test("test_chan");
+    uthread_terminate(0);
+    return 0;
+}
@@ -0,0 +1,34 @@
+#ifndef UTHREADS_TEST_CHECK_H
+#define UTHREADS_TEST_CHECK_H
+
+#include <cstdio>
+#include <cstdlib>
+
+/**
+ * checks shared by the test programs. a failed check is reported on stderr and counted, and the test goes on, so one
+ * run shows every check that fails. the threads of several workers may fail at the same time.
+ */
+
+#define CHECK(cond) do { if(!(cond)) fail(#cond, __FILE__, __LINE__); } while(0)
+
+static volatile int failures;
+
+static inline void fail(const char* what, const char* file, int line)
+{
+    fprintf(stderr, "%s:%d: check failed: %s\n", file, line, what);
+    __atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * prints "<name>: ok", or exits with status 1 if a check failed
+ */
+static inline void finish_test(const char* name)
+{
+    if(failures != 0){
+        fprintf(stderr, "%s: %d failures\n", name, failures);
+        exit(1);
+    }
+    printf("%s: ok\n", name);
+}
+
+#endif //UTHREADS_TEST_CHECK_H
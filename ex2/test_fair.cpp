@@ -0,0 +1,115 @@
+//
+// test of UTHREAD_SCHED_FAIR: threads that spin with weights 1, 2 and 4 times the default get quantums in that
+// proportion, and a thread with a slice of several quantums gets as much CPU time as one with the default slice, in
+// fewer and longer turns.
+//
+// the timer runs on CLOCK_MONOTONIC, so every quantum has the same length. the main thread spins along with the
+// others, at the default weight, while it counts the quantums.
+// the error cases print library errors on stderr, only a failed check makes the test exit with a nonzero status.
+//
+// usage: ./test_fair
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include "uthreads.h"
+#include "test_check.h"
+
+#define QUANTUM_USECS 1000
+#define SHARE_QUANTUMS 800 // quantums of the weight test, a hundred per default weight
+#define SLICE 4
+#define SLICE_QUANTUMS 300 // quantums of the slice test
+#define TOLERANCE 0.15 // relative error allowed on a share
+#define STACK_BYTES 65536
+
+static volatile int stop;
+
+static void* spin(void*){
+    while(!stop){
+    }
+    return nullptr;
+}
+
+static void spin_for(int quantums){
+    int start = uthread_get_total_quantums();
+    while(uthread_get_total_quantums() - start < quantums){
+    }
+}
+
+static bool close_to(double value, double expected){
+    return value > expected * (1 - TOLERANCE) && value < expected * (1 + TOLERANCE);
+}
+
+static void test_weights(){
+    static const int weights[] = {UTHREAD_DEFAULT_WEIGHT, 2 * UTHREAD_DEFAULT_WEIGHT, 4 * UTHREAD_DEFAULT_WEIGHT};
+    const int count = sizeof(weights) / sizeof(weights[0]);
+    int tids[count], start[count];
+    stop = 0;
+    for(int i = 0; i < count; i++){
+        tids[i] = uthread_create(&spin, nullptr);
+        CHECK(uthread_set_weight(tids[i], weights[i]) == 0);
+        start[i] = uthread_get_quantums(tids[i]);
+    }
+    spin_for(SHARE_QUANTUMS);
+    int quantums[count];
+    for(int i = 0; i < count; i++){
+        quantums[i] = uthread_get_quantums(tids[i]) - start[i];
+    }
+    stop = 1;
+    for(int i = 0; i < count; i++){
+        CHECK(uthread_join(tids[i], nullptr) == 0);
+    }
+    for(int i = 1; i < count; i++){
+        double expected = (double) weights[i] / weights[0];
+        if(!close_to((double) quantums[i] / quantums[0], expected)){
+            fprintf(stderr, "weight %d: %d quantums, weight %d: %d quantums, expected a ratio of %.1f\n", weights[i],
+                    quantums[i], weights[0], quantums[0], expected);
+            fail("the quantums are not proportional to the weights", __FILE__, __LINE__);
+        }
+    }
+}
+
+static void test_slice(){
+    stop = 0;
+    int normal = uthread_create(&spin, nullptr);
+    int sliced = uthread_create(&spin, nullptr);
+    CHECK(uthread_set_slice(sliced, SLICE) == 0);
+    uthread_stats normal_stats, sliced_stats;
+    spin_for(SLICE_QUANTUMS);
+    int normal_quantums = uthread_get_quantums(normal), sliced_quantums = uthread_get_quantums(sliced);
+    CHECK(uthread_get_stats(normal, &normal_stats) == 0 && uthread_get_stats(sliced, &sliced_stats) == 0);
+    stop = 1;
+    CHECK(uthread_join(normal, nullptr) == 0 && uthread_join(sliced, nullptr) == 0);
+    double turns = (double) normal_quantums / sliced_quantums;
+    double time = (double) sliced_stats.run_ns / normal_stats.run_ns;
+    if(!close_to(turns, SLICE) || !close_to(time, 1)){
+        fprintf(stderr, "slice %d: %d quantums and %llu ns, slice 1: %d quantums and %llu ns\n", SLICE,
+                sliced_quantums, sliced_stats.run_ns, normal_quantums, normal_stats.run_ns);
+        fail("a longer slice does not give fewer turns of the same CPU time", __FILE__, __LINE__);
+    }
+}
+
+static void test_errors(){
+    CHECK(uthread_set_weight(0, 0) == -1);
+    CHECK(uthread_set_weight(0, UTHREAD_MAX_WEIGHT + 1) == -1);
+    CHECK(uthread_set_weight(MAX_THREAD_NUM - 1, UTHREAD_DEFAULT_WEIGHT) == -1);
+    CHECK(uthread_set_slice(0, 0) == -1);
+    CHECK(uthread_set_slice(0, UTHREAD_MAX_SLICE + 1) == -1);
+}
+
+int main(){
+    uthread_config config = {0};
+    config.quantum_usecs = QUANTUM_USECS;
+    config.sched_policy = UTHREAD_SCHED_FAIR;
+    config.clock = UTHREAD_CLOCK_MONOTONIC;
+    config.stack_size = STACK_BYTES;
+    if(uthread_init_ex(&config) == -1){
+        return 1;
+    }
+    test_weights();
+    test_slice();
+    test_errors();
+    finish_test("test_fair");
+    uthread_terminate(0);
+    return 0;
+}
@@ -0,0 +1,199 @@
+//
+// test of the blocking I/O calls: writers and readers streaming data through pipes far larger than the pipe buffer,
+// clients talking to an echo server over loopback TCP, and an fsync of a temporary file. every byte must arrive
+// intact and in order, with the epoll engine or with io_uring.
+//
+// usage: ./test_io [workers] [io_uring]
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "uthreads.h"
+#include "test_check.h"
+
+#define PIPES 8
+#define PIPE_BYTES (1 << 20) // bytes sent through each pipe
+#define CHUNK 4096
+#define CLIENTS 32
+#define ECHOES 20 // messages each client sends and reads back
+#define STACK_BYTES 65536
+
+static unsigned char pattern(long offset, long stream){
+    return (unsigned char) (offset * 31 + stream * 7 + (offset >> 8));
+}
+
+static int pipes[PIPES][2];
+
+static void* pipe_writer(void* arg){
+    long stream = (long) arg;
+    unsigned char chunk[CHUNK];
+    for(long sent = 0; sent < PIPE_BYTES; ){
+        long size = PIPE_BYTES - sent < CHUNK ? PIPE_BYTES - sent : CHUNK;
+        for(long i = 0; i < size; i++){
+            chunk[i] = pattern(sent + i, stream);
+        }
+        for(long done = 0; done < size; ){
+            ssize_t n = uthread_write(pipes[stream][1], chunk + done, size - done);
+            if(n <= 0){
+                fail("pipe write failed", __FILE__, __LINE__);
+                return nullptr;
+            }
+            done += n;
+        }
+        sent += size;
+    }
+    close(pipes[stream][1]);
+    return nullptr;
+}
+
+static void* pipe_reader(void* arg){
+    long stream = (long) arg;
+    unsigned char chunk[CHUNK];
+    long received = 0;
+    for(;;){
+        ssize_t n = uthread_read(pipes[stream][0], chunk, sizeof(chunk));
+        if(n < 0){
+            fail("pipe read failed", __FILE__, __LINE__);
+            break;
+        }
+        if(n == 0){
+            break;
+        }
+        for(ssize_t i = 0; i < n; i++){
+            if(chunk[i] != pattern(received + i, stream)){
+                fail("corrupted pipe data", __FILE__, __LINE__);
+                return nullptr;
+            }
+        }
+        received += n;
+    }
+    close(pipes[stream][0]);
+    CHECK(received == PIPE_BYTES);
+    return nullptr;
+}
+
+static void test_pipes(){
+    int tids[2 * PIPES];
+    for(long i = 0; i < PIPES; i++){
+        CHECK(pipe(pipes[i]) == 0);
+        tids[2 * i] = uthread_create(&pipe_reader, (void*) i);
+        tids[2 * i + 1] = uthread_create(&pipe_writer, (void*) i);
+    }
+    for(int i = 0; i < 2 * PIPES; i++){
+        CHECK(uthread_join(tids[i], nullptr) == 0);
+    }
+}
+
+static int listener;
+static sockaddr_in server_addr;
+
+static void* echo(void* arg){
+    int fd = (int) (long) arg;
+    char buf[64];
+    for(;;){
+        ssize_t n = uthread_read(fd, buf, sizeof(buf));
+        if(n <= 0){
+            CHECK(n == 0);
+            break;
+        }
+        CHECK(uthread_write(fd, buf, n) == n);
+    }
+    close(fd);
+    return nullptr;
+}
+
+static void* server(void*){
+    for(int i = 0; i < CLIENTS; i++){
+        int fd = uthread_accept(listener, nullptr, nullptr);
+        if(fd == -1){
+            fail("accept failed", __FILE__, __LINE__);
+            break;
+        }
+        int tid = uthread_create(&echo, (void*) (long) fd);
+        CHECK(tid != -1 && uthread_detach(tid) == 0);
+    }
+    return nullptr;
+}
+
+static void* client(void*){
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(uthread_connect(fd, (sockaddr*) &server_addr, sizeof(server_addr)) != 0){
+        fail("connect failed", __FILE__, __LINE__);
+        close(fd);
+        return nullptr;
+    }
+    for(int round = 0; round < ECHOES; round++){
+        char out[64], in[64];
+        int len = snprintf(out, sizeof(out), "client %d round %d", uthread_get_tid(), round) + 1;
+        CHECK(uthread_write(fd, out, len) == len);
+        int got = 0;
+        while(got < len){
+            ssize_t n = uthread_read(fd, in + got, len - got);
+            if(n <= 0){
+                fail("echo read failed", __FILE__, __LINE__);
+                break;
+            }
+            got += n;
+        }
+        CHECK(got == len && memcmp(in, out, len) == 0);
+    }
+    close(fd);
+    return nullptr;
+}
+
+static void test_sockets(){
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    server_addr.sin_port = 0;
+    socklen_t len = sizeof(server_addr);
+    CHECK(bind(listener, (sockaddr*) &server_addr, sizeof(server_addr)) == 0);
+    CHECK(listen(listener, CLIENTS) == 0);
+    CHECK(getsockname(listener, (sockaddr*) &server_addr, &len) == 0);
+    int tids[CLIENTS + 1];
+    tids[0] = uthread_create(&server, nullptr);
+    for(int i = 1; i <= CLIENTS; i++){
+        tids[i] = uthread_create(&client, nullptr);
+    }
+    for(int i = 0; i <= CLIENTS; i++){
+        CHECK(uthread_join(tids[i], nullptr) == 0);
+    }
+    close(listener);
+}
+
+static void test_fsync(){
+    char path[] = "/tmp/test_io.XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd != -1);
+    unlink(path);
+    CHECK(uthread_write(fd, "fsync", 5) == 5);
+    CHECK(uthread_fsync(fd) == 0);
+    CHECK(lseek(fd, 0, SEEK_SET) == 0);
+    char buf[8] = {0};
+    CHECK(uthread_read(fd, buf, sizeof(buf)) == 5 && memcmp(buf, "fsync", 5) == 0);
+    close(fd);
+    CHECK(uthread_fsync(fd) == -1);
+}
+
+int main(int argc, char** argv){
+    uthread_config config = {0};
+    config.workers = argc > 1 ? atoi(argv[1]) : 1;
+    config.io_uring = argc > 2 ? atoi(argv[2]) : 0;
+    config.quantum_usecs = 1000;
+    config.max_threads = 2 * CLIENTS + 2;
+    config.stack_size = STACK_BYTES;
+    if(uthread_init_ex(&config) == -1){
+        return 1;
+    }
+    test_pipes();
+    test_sockets();
+    test_fsync();
+    finish_test("test_io");
+    uthread_terminate(0);
+    return 0;
+}
@@ -0,0 +1,132 @@
+//
+// test of uthread_create, uthread_join, uthread_detach and uthread_exit: return values reach the joining thread,
+// terminated threads stay joinable, detached threads release their IDs, and the error cases of join and detach fail.
+//
+// the error cases print library errors on stderr, only a failed check makes the test exit with a nonzero status.
+//
+// usage: ./test_join [workers]
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include "uthreads.h"
+#include "test_check.h"
+
+#define MAX_THREADS 8
+#define DETACHED_ROUNDS 100 // detached threads created one after another, many more than MAX_THREADS
+#define STACK_BYTES 65536
+
+static void* add_one(void* arg){
+    uthread_yield();
+    return (void*) ((long) arg + 1);
+}
+
+static void* exit_early(void* arg){
+    uthread_exit(arg);
+    fail("uthread_exit returned", __FILE__, __LINE__);
+    return nullptr;
+}
+
+static volatile int stop;
+
+static void* spin(void*){
+    while(!stop){
+        uthread_yield();
+    }
+    return (void*) 1;
+}
+
+static void* join_self(void*){
+    return (void*) (long) (uthread_join(uthread_get_tid(), nullptr) == -1);
+}
+
+static volatile int finished;
+
+static void* count_finished(void*){
+    __atomic_add_fetch(&finished, 1, __ATOMIC_RELAXED);
+    return nullptr;
+}
+
+static void spawned(){
+    uthread_terminate(uthread_get_tid());
+}
+
+static void test_return_values(){
+    int tids[MAX_THREADS - 1];
+    for(long i = 0; i < MAX_THREADS - 1; i++){
+        tids[i] = uthread_create(i % 2 ? &add_one : &exit_early, (void*) (i * 10));
+        CHECK(tids[i] != -1);
+    }
+    CHECK(uthread_create(&add_one, nullptr) == -1);
+    for(long i = 0; i < MAX_THREADS - 1; i++){
+        void* retval = nullptr;
+        CHECK(uthread_join(tids[i], &retval) == 0);
+        CHECK((long) retval == (i % 2 ? i * 10 + 1 : i * 10));
+        CHECK(uthread_join(tids[i], nullptr) == -1); // the ID was released
+    }
+}
+
+static void test_terminated(){
+    stop = 0;
+    int tid = uthread_create(&spin, nullptr);
+    uthread_yield();
+    CHECK(uthread_terminate(tid) == 0);
+    void* retval = (void*) 1;
+    CHECK(uthread_join(tid, &retval) == 0);
+    CHECK(retval == nullptr);
+}
+
+static void test_detached(){
+    for(int round = 0; round < DETACHED_ROUNDS; round++){
+        int tid = uthread_create(&count_finished, nullptr);
+        CHECK(tid != -1);
+        CHECK(uthread_detach(tid) == 0);
+        if(round == 0){
+            CHECK(uthread_join(tid, nullptr) == -1);
+        }
+        while(finished <= round){
+            uthread_yield();
+        }
+    }
+    stop = 0;
+    int tid = uthread_create(&spin, nullptr);
+    uthread_yield();
+    CHECK(uthread_detach(tid) == 0);
+    stop = 1;
+    while(uthread_get_quantums(tid) != -1){ // spin returns and releases its ID
+        uthread_yield();
+    }
+    int spawned_tid = uthread_spawn(&spawned);
+    CHECK(spawned_tid != -1);
+    CHECK(uthread_join(spawned_tid, nullptr) == -1);
+}
+
+static void test_errors(){
+    CHECK(uthread_join(uthread_get_tid(), nullptr) == -1);
+    CHECK(uthread_join(MAX_THREADS - 1, nullptr) == -1);
+    CHECK(uthread_join(-1, nullptr) == -1);
+    CHECK(uthread_detach(MAX_THREADS) == -1);
+    CHECK(uthread_create(nullptr, nullptr) == -1);
+    int tid = uthread_create(&join_self, nullptr);
+    void* ok = nullptr;
+    CHECK(uthread_join(tid, &ok) == 0);
+    CHECK(ok != nullptr);
+}
+
+int main(int argc, char** argv){
+    uthread_config config = {0};
+    config.workers = argc > 1 ? atoi(argv[1]) : 1;
+    config.quantum_usecs = 1000;
+    config.max_threads = MAX_THREADS;
+    config.stack_size = STACK_BYTES;
+    if(uthread_init_ex(&config) == -1){
+        return 1;
+    }
+    test_return_values();
+    test_terminated();
+    test_detached();
+    test_errors();
+    finish_test("test_join");
+    uthread_terminate(0);
+    return 0;
+}
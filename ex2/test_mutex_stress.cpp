@@ -0,0 +1,65 @@
+//
+// regression test of the mutex under M:N scheduling: many threads lock and unlock one mutex while short quantums
+// preempt them and move them between the workers. a thread that reads its tid on one worker and resumes on another
+// must still lock and unlock as itself, so every call has to succeed and no increment of the counter may be lost.
+//
+// usage: ./test_mutex_stress [workers] [quantum_usecs]
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include "uthreads.h"
+#include "test_check.h"
+
+#define THREADS 64
+#define ROUNDS 20000
+#define YIELD_EVERY 97 // rounds between two yields of a thread
+#define SLEEP_EVERY 4999 // rounds between two one-quantum sleeps of a thread
+#define DEFAULT_WORKERS 8
+#define DEFAULT_QUANTUM_USECS 100
+
+static uthread_mutex_t mutex = UTHREAD_MUTEX_INITIALIZER;
+static long counter;
+
+static void* hammer(void*){
+    for(int round = 0; round < ROUNDS; round++){
+        if(uthread_mutex_lock(&mutex) != 0){
+            fail("lock failed", __FILE__, __LINE__);
+            continue;
+        }
+        CHECK(__atomic_load_n(&mutex.owner, __ATOMIC_RELAXED) == uthread_get_tid());
+        counter += 1;
+        CHECK(uthread_mutex_unlock(&mutex) == 0);
+        if(round % YIELD_EVERY == 0){
+            uthread_yield();
+        }
+        if(round % SLEEP_EVERY == SLEEP_EVERY - 1){
+            CHECK(uthread_sleep(1) == 0);
+        }
+    }
+    return nullptr;
+}
+
+int main(int argc, char** argv){
+    uthread_config config = {0};
+    config.workers = argc > 1 ? atoi(argv[1]) : DEFAULT_WORKERS;
+    config.quantum_usecs = argc > 2 ? atoi(argv[2]) : DEFAULT_QUANTUM_USECS;
+    config.max_threads = THREADS + 1;
+    if(uthread_init_ex(&config) == -1){
+        return 1;
+    }
+    int tids[THREADS];
+    for(int i = 0; i < THREADS; i++){
+        tids[i] = uthread_create(&hammer, nullptr);
+        if(tids[i] == -1){
+            return 1;
+        }
+    }
+    for(int i = 0; i < THREADS; i++){
+        uthread_join(tids[i], nullptr);
+    }
+    CHECK(counter == (long) THREADS * ROUNDS);
+    finish_test("test_mutex_stress");
+    uthread_terminate(0);
+    return 0;
+}
@@ -0,0 +1,110 @@
+//
+// test of the priority levels: a thread spawned above the caller runs at once, READY threads run from the highest
+// priority level down, threads of one level take turns round-robin, a lower level never runs while a higher one is
+// READY, and raising a READY thread above the running one switches to it right away.
+//
+// the quantum is long, so the timer does not preempt the short turns whose order is checked.
+// the error cases print library errors on stderr, only a failed check makes the test exit with a nonzero status.
+//
+// usage: ./test_priority
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include "uthreads.h"
+#include "test_check.h"
+
+#define QUANTUM_USECS 50000
+#define LOWEST (UTHREAD_PRIORITY_LEVELS - 1)
+#define TURNS 5 // turns of each thread in the round-robin test
+#define STARVED_QUANTUMS 3 // quantums the main thread runs while a lower priority thread is READY
+
+static int ran[4 * TURNS]; // tids in the order their turns started
+static int runs;
+
+static void run_once(){
+    ran[runs++] = uthread_get_tid();
+    uthread_terminate(uthread_get_tid());
+}
+
+static void take_turns(){
+    for(int turn = 0; turn < TURNS; turn++){
+        ran[runs++] = uthread_get_tid();
+        uthread_yield();
+    }
+    uthread_terminate(uthread_get_tid());
+}
+
+static void test_spawn_preempts(){
+    runs = 0;
+    int tid = uthread_spawn_prio(&run_once, UTHREAD_DEFAULT_PRIORITY - 1);
+    CHECK(runs == 1 && ran[0] == tid);
+    tid = uthread_spawn_prio(&run_once, UTHREAD_DEFAULT_PRIORITY);
+    CHECK(runs == 1); // same level as the caller, it waits for its turn
+    uthread_yield();
+    CHECK(runs == 2 && ran[1] == tid);
+}
+
+static void test_level_order(){
+    static const int priorities[] = {20, 28, 18, 24};
+    const int count = sizeof(priorities) / sizeof(priorities[0]);
+    int priority_of[MAX_THREAD_NUM];
+    runs = 0;
+    for(int i = 0; i < count; i++){
+        int tid = uthread_spawn_prio(&run_once, priorities[i]);
+        CHECK(tid != -1);
+        priority_of[tid] = priorities[i];
+    }
+    CHECK(runs == 0);
+    CHECK(uthread_set_priority(0, LOWEST) == 0); // the others run before this returns
+    CHECK(runs == count);
+    for(int i = 1; i < runs; i++){
+        CHECK(priority_of[ran[i - 1]] < priority_of[ran[i]]);
+    }
+    CHECK(uthread_set_priority(0, UTHREAD_DEFAULT_PRIORITY) == 0);
+}
+
+static void test_round_robin(){
+    runs = 0;
+    int first = uthread_spawn_prio(&take_turns, 20);
+    int second = uthread_spawn_prio(&take_turns, 20);
+    CHECK(uthread_set_priority(0, LOWEST) == 0);
+    CHECK(runs == 2 * TURNS);
+    for(int i = 0; i < runs; i++){
+        CHECK(ran[i] == (i % 2 ? second : first));
+    }
+    CHECK(uthread_set_priority(0, UTHREAD_DEFAULT_PRIORITY) == 0);
+}
+
+static void test_lower_level_waits(){
+    runs = 0;
+    int low = uthread_spawn_prio(&run_once, LOWEST);
+    int start = uthread_get_total_quantums();
+    while(uthread_get_total_quantums() - start < STARVED_QUANTUMS){
+    }
+    CHECK(runs == 0);
+    CHECK(uthread_set_priority(low, 0) == 0); // it runs before this returns
+    CHECK(runs == 1 && ran[0] == low);
+}
+
+static void test_errors(){
+    CHECK(uthread_spawn_prio(&run_once, -1) == -1);
+    CHECK(uthread_spawn_prio(&run_once, UTHREAD_PRIORITY_LEVELS) == -1);
+    CHECK(uthread_spawn_prio(nullptr, 0) == -1);
+    CHECK(uthread_set_priority(0, UTHREAD_PRIORITY_LEVELS) == -1);
+    CHECK(uthread_set_priority(MAX_THREAD_NUM - 1, 0) == -1);
+}
+
+int main(){
+    if(uthread_init(QUANTUM_USECS) == -1){
+        return 1;
+    }
+    test_spawn_preempts();
+    test_level_order();
+    test_round_robin();
+    test_lower_level_waits();
+    test_errors();
+    finish_test("test_priority");
+    uthread_terminate(0);
+    return 0;
+}
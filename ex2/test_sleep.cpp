@@ -0,0 +1,94 @@
+//
+// test of uthread_sleep and uthread_sleep_us under a given timer clock: threads that sleep for different numbers of
+// quantums, or of micro-seconds, while another thread keeps the CPU busy, must wake in the order of their deadlines
+// and no earlier than them.
+//
+// the error cases print library errors on stderr, only a failed check makes the test exit with a nonzero status.
+//
+// usage: ./test_sleep [clock]
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include "uthreads.h"
+#include "test_check.h"
+
+#define SLEEPERS 8
+#define SPACING (2 * SLEEPERS) // quantums between two sleep lengths, more than between the starts of the sleepers
+#define SPACING_USECS 10000 // between two sleep lengths of uthread_sleep_us, ten quantums
+#define STACK_BYTES 65536
+
+static const int order[SLEEPERS] = {5, 2, 7, 0, 3, 6, 1, 4}; // scrambled ranks of the sleep lengths
+
+static volatile int awake;
+static int wake_rank[SLEEPERS];
+
+static void* spin(void*){
+    while(awake < SLEEPERS){
+    }
+    return nullptr;
+}
+
+static void* sleep_quantums(void* arg){
+    int rank = (int) (long) arg;
+    int quantums = (rank + 1) * SPACING;
+    int start = uthread_get_total_quantums();
+    CHECK(uthread_sleep(quantums) == 0);
+    CHECK(uthread_get_total_quantums() - start >= quantums);
+    wake_rank[__atomic_fetch_add(&awake, 1, __ATOMIC_RELAXED)] = rank;
+    return nullptr;
+}
+
+static long now_usecs(){
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000L + now.tv_nsec / 1000;
+}
+
+static void* sleep_usecs(void* arg){
+    int rank = (int) (long) arg;
+    long usecs = (rank + 1) * SPACING_USECS;
+    long start = now_usecs();
+    CHECK(uthread_sleep_us(usecs) == 0);
+    CHECK(now_usecs() - start >= usecs);
+    wake_rank[__atomic_fetch_add(&awake, 1, __ATOMIC_RELAXED)] = rank;
+    return nullptr;
+}
+
+static void test_sleep_order(uthread_start_routine sleeper){
+    awake = 0;
+    int tids[SLEEPERS + 1];
+    tids[SLEEPERS] = uthread_create(&spin, nullptr);
+    for(int i = 0; i < SLEEPERS; i++){
+        tids[i] = uthread_create(sleeper, (void*) (long) order[i]);
+    }
+    for(int i = 0; i <= SLEEPERS; i++){
+        CHECK(uthread_join(tids[i], nullptr) == 0);
+    }
+    for(int i = 0; i < SLEEPERS; i++){
+        CHECK(wake_rank[i] == i);
+    }
+}
+
+static void test_errors(){
+    CHECK(uthread_sleep(1) == -1); // the main thread
+    CHECK(uthread_sleep(0) == -1);
+    CHECK(uthread_sleep_us(1) == -1);
+}
+
+int main(int argc, char** argv){
+    uthread_config config = {0};
+    config.clock = argc > 1 ? atoi(argv[1]) : UTHREAD_CLOCK_VIRTUAL;
+    config.quantum_usecs = 1000;
+    config.stack_size = STACK_BYTES;
+    if(uthread_init_ex(&config) == -1){
+        return 1;
+    }
+    test_sleep_order(&sleep_quantums);
+    test_sleep_order(&sleep_usecs);
+    test_errors();
+    finish_test("test_sleep");
+    uthread_terminate(0);
+    return 0;
+}
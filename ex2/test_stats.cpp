@@ -0,0 +1,125 @@
+//
+// test of the scheduling statistics: threads that yield, sleep and get preempted must see their own voluntary and
+// involuntary switches and their RUNNING, READY and blocked times, with histograms that count every turn. the
+// statistics of the process must include those of the threads after they terminated.
+//
+// the timer runs on CLOCK_MONOTONIC, so the threads that spin are preempted at every quantum.
+// the error cases print library errors on stderr, only a failed check makes the test exit with a nonzero status.
+//
+// usage: ./test_stats
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include "uthreads.h"
+#include "test_check.h"
+
+#define QUANTUM_USECS 1000
+#define YIELDS 50
+#define SLEEP_USECS 20000
+#define SPIN_QUANTUMS 10 // quantums each of two spinners runs for, taking turns
+#define STACK_BYTES 65536
+
+static uthread_stats recorded[5]; // the statistics every thread saw just before it returned
+
+static unsigned long long sum(const unsigned long long* hist){
+    unsigned long long total = 0;
+    for(int i = 0; i < UTHREAD_STATS_BUCKETS; i++){
+        total += hist[i];
+    }
+    return total;
+}
+
+/**
+ * the statistics of the running thread: every turn that ended was a switch, and the current one was dispatched too
+ */
+static void record(int slot){
+    uthread_stats* stats = &recorded[slot];
+    CHECK(uthread_get_stats(uthread_get_tid(), stats) == 0);
+    unsigned long long switches = stats->voluntary_switches + stats->involuntary_switches;
+    CHECK(sum(stats->run_hist) == switches);
+    CHECK(sum(stats->wait_hist) == switches + 1);
+}
+
+static void* yielder(void* arg){
+    for(int i = 0; i < YIELDS; i++){
+        CHECK(uthread_yield() == 0);
+    }
+    record((int) (long) arg);
+    return nullptr;
+}
+
+static void* sleeper(void* arg){
+    CHECK(uthread_sleep_us(SLEEP_USECS) == 0);
+    record((int) (long) arg);
+    return nullptr;
+}
+
+static void* spinner(void* arg){
+    int start = uthread_get_quantums(uthread_get_tid());
+    while(uthread_get_quantums(uthread_get_tid()) - start < SPIN_QUANTUMS){
+    }
+    record((int) (long) arg);
+    return nullptr;
+}
+
+static void run(uthread_start_routine first, uthread_start_routine second, int slot){
+    int tids[2] = {uthread_create(first, (void*) (long) slot), uthread_create(second, (void*) (long) (slot + 1))};
+    CHECK(uthread_join(tids[0], nullptr) == 0 && uthread_join(tids[1], nullptr) == 0);
+}
+
+static void test_threads(){
+    run(&yielder, &yielder, 0);
+    for(int i = 0; i < 2; i++){
+        CHECK(recorded[i].voluntary_switches >= YIELDS);
+    }
+    run(&spinner, &spinner, 2);
+    for(int i = 2; i < 4; i++){
+        CHECK(recorded[i].involuntary_switches >= SPIN_QUANTUMS - 1);
+        CHECK(recorded[i].run_ns >= (SPIN_QUANTUMS - 1) * QUANTUM_USECS * 1000ULL / 2);
+        CHECK(recorded[i].wait_ns >= (SPIN_QUANTUMS - 1) * QUANTUM_USECS * 1000ULL / 2);
+    }
+    int tid = uthread_create(&sleeper, (void*) 4);
+    CHECK(uthread_join(tid, nullptr) == 0);
+    CHECK(recorded[4].voluntary_switches >= 1);
+    CHECK(recorded[4].blocked_ns >= SLEEP_USECS * 1000ULL * 9 / 10);
+}
+
+static void test_process(){
+    uthread_stats process, threads = {};
+    CHECK(uthread_get_process_stats(&process) == 0);
+    for(int i = 0; i < 5; i++){
+        threads.voluntary_switches += recorded[i].voluntary_switches;
+        threads.involuntary_switches += recorded[i].involuntary_switches;
+        threads.run_ns += recorded[i].run_ns;
+        threads.blocked_ns += recorded[i].blocked_ns;
+    }
+    CHECK(process.voluntary_switches >= threads.voluntary_switches);
+    CHECK(process.involuntary_switches >= threads.involuntary_switches);
+    CHECK(process.run_ns >= threads.run_ns);
+    CHECK(process.blocked_ns >= threads.blocked_ns);
+    CHECK(sum(process.run_hist) <= sum(process.wait_hist));
+}
+
+static void test_errors(){
+    uthread_stats stats;
+    CHECK(uthread_get_stats(0, nullptr) == -1);
+    CHECK(uthread_get_stats(MAX_THREAD_NUM - 1, &stats) == -1);
+    CHECK(uthread_get_process_stats(nullptr) == -1);
+}
+
+int main(){
+    uthread_config config = {0};
+    config.quantum_usecs = QUANTUM_USECS;
+    config.clock = UTHREAD_CLOCK_MONOTONIC;
+    config.stack_size = STACK_BYTES;
+    if(uthread_init_ex(&config) == -1){
+        return 1;
+    }
+    test_threads();
+    test_process();
+    test_errors();
+    finish_test("test_stats");
+    uthread_terminate(0);
+    return 0;
+}
@@ -0,0 +1,199 @@
+//
+// test of the mutex and the condition variable: a counter updated under a mutex by threads that yield inside the
+// critical section, the error paths of the mutex, a bounded buffer between producers and consumers and a broadcast
+// that must wake every waiter.
+//
+// the error cases print library errors on stderr, only a failed check makes the test exit with a nonzero status.
+//
+// usage: ./test_sync [workers]
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include "uthreads.h"
+#include "test_check.h"
+
+#define THREADS 16
+#define ROUNDS 2000
+#define PRODUCERS 4
+#define CONSUMERS 4
+#define ITEMS 5000 // items sent by each producer
+#define BUFFER_SIZE 4
+#define WAITERS 16
+#define STACK_BYTES 65536
+
+static uthread_mutex_t mutex = UTHREAD_MUTEX_INITIALIZER;
+static long counter;
+
+static void* increment(void*){
+    for(int round = 0; round < ROUNDS; round++){
+        CHECK(uthread_mutex_lock(&mutex) == 0);
+        long seen = counter;
+        if(round % 7 == 0){
+            uthread_yield(); // let the others pile up on the mutex
+        }
+        counter = seen + 1;
+        CHECK(uthread_mutex_unlock(&mutex) == 0);
+    }
+    return nullptr;
+}
+
+static void test_counter(){
+    int tids[THREADS];
+    for(int i = 0; i < THREADS; i++){
+        tids[i] = uthread_create(&increment, nullptr);
+        CHECK(tids[i] != -1);
+    }
+    for(int i = 0; i < THREADS; i++){
+        CHECK(uthread_join(tids[i], nullptr) == 0);
+    }
+    CHECK(counter == (long) THREADS * ROUNDS);
+}
+
+static void* try_held(void* arg){
+    uthread_mutex_t* held = (uthread_mutex_t*) arg;
+    bool ok = uthread_mutex_trylock(held) == -1 && uthread_mutex_unlock(held) == -1;
+    return (void*) (long) ok;
+}
+
+static void test_errors(){
+    uthread_mutex_t m;
+    CHECK(uthread_mutex_init(&m) == 0);
+    CHECK(uthread_mutex_unlock(&m) == -1);
+    CHECK(uthread_mutex_trylock(&m) == 0);
+    CHECK(m.owner == uthread_get_tid());
+    CHECK(uthread_mutex_lock(&m) == -1);
+    CHECK(uthread_mutex_destroy(&m) == -1);
+    int tid = uthread_create(&try_held, &m);
+    void* ok = nullptr;
+    CHECK(uthread_join(tid, &ok) == 0);
+    CHECK(ok != nullptr);
+    CHECK(uthread_mutex_unlock(&m) == 0);
+    CHECK(m.owner == -1);
+    CHECK(uthread_mutex_destroy(&m) == 0);
+}
+
+static uthread_cond_t not_empty = UTHREAD_COND_INITIALIZER;
+static uthread_cond_t not_full = UTHREAD_COND_INITIALIZER;
+static long buffer[BUFFER_SIZE];
+static int head, count;
+static long consumed[CONSUMERS];
+
+static void put(long item){
+    CHECK(uthread_mutex_lock(&mutex) == 0);
+    while(count == BUFFER_SIZE){
+        CHECK(uthread_cond_wait(&not_full, &mutex) == 0);
+    }
+    buffer[(head + count) % BUFFER_SIZE] = item;
+    count++;
+    CHECK(uthread_cond_signal(&not_empty) == 0);
+    CHECK(uthread_mutex_unlock(&mutex) == 0);
+}
+
+static long take(){
+    CHECK(uthread_mutex_lock(&mutex) == 0);
+    while(count == 0){
+        CHECK(uthread_cond_wait(&not_empty, &mutex) == 0);
+    }
+    long item = buffer[head];
+    head = (head + 1) % BUFFER_SIZE;
+    count--;
+    CHECK(uthread_cond_signal(&not_full) == 0);
+    CHECK(uthread_mutex_unlock(&mutex) == 0);
+    return item;
+}
+
+static void* producer(void* arg){
+    long base = (long) arg * ITEMS;
+    for(long i = 1; i <= ITEMS; i++){
+        put(base + i);
+    }
+    return nullptr;
+}
+
+static void* consumer(void* arg){
+    long sum = 0;
+    for(long item = take(); item != -1; item = take()){
+        sum += item;
+    }
+    consumed[(long) arg] = sum;
+    return nullptr;
+}
+
+static void test_bounded_buffer(){
+    int consumers[CONSUMERS], producers[PRODUCERS];
+    for(long i = 0; i < CONSUMERS; i++){
+        consumers[i] = uthread_create(&consumer, (void*) i);
+    }
+    for(long i = 0; i < PRODUCERS; i++){
+        producers[i] = uthread_create(&producer, (void*) i);
+    }
+    for(int i = 0; i < PRODUCERS; i++){
+        CHECK(uthread_join(producers[i], nullptr) == 0);
+    }
+    for(int i = 0; i < CONSUMERS; i++){
+        put(-1);
+    }
+    long total = 0;
+    for(int i = 0; i < CONSUMERS; i++){
+        CHECK(uthread_join(consumers[i], nullptr) == 0);
+        total += consumed[i];
+    }
+    long items = (long) PRODUCERS * ITEMS;
+    CHECK(total == items * (items + 1) / 2);
+    CHECK(count == 0);
+}
+
+static uthread_cond_t go_cond = UTHREAD_COND_INITIALIZER;
+static bool go;
+static int waiting, woken;
+
+static void* wait_for_go(void*){
+    CHECK(uthread_mutex_lock(&mutex) == 0);
+    waiting++;
+    while(!go){
+        CHECK(uthread_cond_wait(&go_cond, &mutex) == 0);
+    }
+    woken++;
+    CHECK(uthread_mutex_unlock(&mutex) == 0);
+    return nullptr;
+}
+
+static void test_broadcast(){
+    int tids[WAITERS];
+    for(int i = 0; i < WAITERS; i++){
+        tids[i] = uthread_create(&wait_for_go, nullptr);
+    }
+    for(bool all = false; !all; ){
+        uthread_yield();
+        CHECK(uthread_mutex_lock(&mutex) == 0);
+        all = waiting == WAITERS;
+        CHECK(uthread_mutex_unlock(&mutex) == 0);
+    }
+    CHECK(uthread_mutex_lock(&mutex) == 0);
+    go = true;
+    CHECK(uthread_cond_broadcast(&go_cond) == 0);
+    CHECK(uthread_mutex_unlock(&mutex) == 0);
+    for(int i = 0; i < WAITERS; i++){
+        CHECK(uthread_join(tids[i], nullptr) == 0);
+    }
+    CHECK(woken == WAITERS);
+    CHECK(uthread_cond_destroy(&go_cond) == 0);
+}
+
+int main(int argc, char** argv){
+    uthread_config config = {0};
+    config.workers = argc > 1 ? atoi(argv[1]) : 1;
+    config.quantum_usecs = 1000;
+    config.stack_size = STACK_BYTES;
+    if(uthread_init_ex(&config) == -1){
+        return 1;
+    }
+    test_counter();
+    test_errors();
+    test_bounded_buffer();
+    test_broadcast();
+    finish_test("test_sync");
+    uthread_terminate(0);
+    return 0;
+}
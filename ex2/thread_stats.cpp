@@ -0,0 +1,139 @@
+#include <sys/mman.h>
+#include "thread_stats.h"
+
+/**
+ * @return the histogram bucket of a time: the position of its highest set bit, so times 0 and 1 go to bucket 0
+ */
+static int bucket(long ns){
+    if(ns < 2){
+        return 0;
+    }
+    int bit = 63 - __builtin_clzl((unsigned long) ns);
+    return bit < UTHREAD_STATS_BUCKETS ? bit : UTHREAD_STATS_BUCKETS - 1;
+}
+
+/**
+ * @return the time since the last change of phase. a thread that moved to another worker may see a TSC a little
+ * behind the one it left, that counts as no time.
+ */
+long ThreadStats::elapsed(long now) const{
+    return now > since ? now - since : 0;
+}
+
+/**
+ * the histograms of the thread that had the tid before are only cleared where they were used
+ */
+void ThreadStats::start(long now){
+    counters.voluntary_switches = 0;
+    counters.involuntary_switches = 0;
+    counters.run_ns = 0;
+    counters.wait_ns = 0;
+    counters.blocked_ns = 0;
+    for(; wait_buckets; wait_buckets &= wait_buckets - 1){
+        counters.wait_hist[__builtin_ctz(wait_buckets)] = 0;
+    }
+    for(; run_buckets; run_buckets &= run_buckets - 1){
+        counters.run_hist[__builtin_ctz(run_buckets)] = 0;
+    }
+    since = now;
+    phase = STATS_BLOCK;
+}
+
+void ThreadStats::ready(long now){
+    if(phase != STATS_BLOCK){
+        return;
+    }
+    counters.blocked_ns += elapsed(now);
+    since = now;
+    phase = STATS_WAIT;
+}
+
+/**
+ * a thread that is dispatched right after it blocked and was resumed (before it became READY through the run queue)
+ * waited for nothing, its blocked time is closed instead
+ */
+void ThreadStats::dispatch(long now){
+    if(phase == STATS_DEAD){
+        return;
+    }
+    long ns = elapsed(now);
+    if(phase == STATS_BLOCK){
+        counters.blocked_ns += ns;
+        ns = 0;
+    }
+    int i = bucket(ns);
+    counters.wait_ns += ns;
+    counters.wait_hist[i] ++;
+    wait_buckets |= 1U << i;
+    since = now;
+    phase = STATS_RUN;
+}
+
+void ThreadStats::stop(long now, bool runnable, bool preempted){
+    if(phase != STATS_RUN){
+        return;
+    }
+    long ns = elapsed(now);
+    int i = bucket(ns);
+    counters.run_ns += ns;
+    counters.run_hist[i] ++;
+    run_buckets |= 1U << i;
+    if(preempted){
+        counters.involuntary_switches ++;
+    }else{
+        counters.voluntary_switches ++;
+    }
+    since = now;
+    phase = runnable ? STATS_WAIT : STATS_BLOCK;
+}
+
+/**
+ * a thread that terminates itself is still running, its last turn counts as a voluntary switch.
+ * whatever phase the thread was in is closed, by going through the blocked and READY phases with no time left.
+ */
+void ThreadStats::retire(long now){
+    if(phase == STATS_DEAD){
+        return;
+    }
+    stop(now, false, false);
+    ready(now);
+    counters.wait_ns += elapsed(now);
+    phase = STATS_DEAD;
+}
+
+void ThreadStats::add_to(long now, uthread_stats* sum) const{
+    long ns = elapsed(now);
+    sum->voluntary_switches += counters.voluntary_switches;
+    sum->involuntary_switches += counters.involuntary_switches;
+    sum->run_ns += counters.run_ns + (phase == STATS_RUN ? ns : 0);
+    sum->wait_ns += counters.wait_ns + (phase == STATS_WAIT ? ns : 0);
+    sum->blocked_ns += counters.blocked_ns + (phase == STATS_BLOCK ? ns : 0);
+    for(uint32_t used = wait_buckets; used; used &= used - 1){
+        int i = __builtin_ctz(used);
+        sum->wait_hist[i] += counters.wait_hist[i];
+    }
+    for(uint32_t used = run_buckets; used; used &= used - 1){
+        int i = __builtin_ctz(used);
+        sum->run_hist[i] += counters.run_hist[i];
+    }
+}
+
+StatsTable::~StatsTable(){
+    if(table){
+        munmap(table, length * sizeof(ThreadStats));
+    }
+}
+
+/**
+ * anonymous memory is zeroed, so every entry starts as STATS_DEAD
+ */
+int StatsTable::init(int size){
+    void* memory = mmap(nullptr, (size_t) size * sizeof(ThreadStats), PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(memory == MAP_FAILED){
+        return -1;
+    }
+    table = (ThreadStats*) memory;
+    length = (size_t) size;
+    return 0;
+}
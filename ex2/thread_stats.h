@@ -0,0 +1,94 @@
+#ifndef UTHREADS_THREAD_STATS_H
+#define UTHREADS_THREAD_STATS_H
+
+#include <cstddef>
+#include <cstdint>
+#include "uthreads.h"
+
+#define STATS_LINE 64 // the statistics of every thread start on a cache line of their own
+
+static_assert(UTHREAD_STATS_BUCKETS <= 32, "the buckets of a histogram that are used are kept in 32 bits");
+
+enum StatsPhase {STATS_DEAD, STATS_RUN, STATS_WAIT, STATS_BLOCK}; // zeroed statistics belong to no thread
+
+/**
+ * the statistics of one thread, and the phase it has been in since the time it last changed.
+ * only the worker that switches the thread, or the thread that makes it READY, writes them, so they need no lock.
+ * the phase and the counters other than the histograms share the first cache line. the histograms keep bitmaps of
+ * their buckets that are not zero, so clearing and summing them only visits the buckets that were used.
+ */
+struct alignas(STATS_LINE) ThreadStats{
+    long since; // Tsc::now_ns()
+    int phase;
+    uint32_t wait_buckets;
+    uint32_t run_buckets;
+    uthread_stats counters;
+
+    long elapsed(long now) const;
+
+    /**
+     * starts over for a new thread, blocked until it is started
+     */
+    void start(long now);
+
+    /**
+     * a blocked thread became READY, a thread that was already waiting or running is not changed
+     */
+    void ready(long now);
+
+    /**
+     * a worker switched to the thread
+     */
+    void dispatch(long now);
+
+    /**
+     * a worker switched away from the thread
+     * @param runnable the thread is still READY, it waits in a run queue instead of being blocked
+     * @param preempted the thread was preempted instead of giving up the CPU
+     */
+    void stop(long now, bool runnable, bool preempted);
+
+    /**
+     * the thread terminated, its running time is closed and it is not counted anymore
+     */
+    void retire(long now);
+
+    /**
+     * adds the counters to sum, with the time since the last change added to the current phase
+     */
+    void add_to(long now, uthread_stats* sum) const;
+};
+
+/**
+ * the statistics of all the threads, indexed by tid, in an array that is mapped once when the library starts.
+ * the kernel only backs the pages that are touched, so the threads that are never spawned cost nothing, and recording a
+ * switch never allocates.
+ */
+class StatsTable{
+    ThreadStats* table = nullptr;
+    size_t length = 0;
+public :
+    StatsTable() = default;
+
+    StatsTable(const StatsTable&) = delete;
+
+    StatsTable& operator=(const StatsTable&) = delete;
+
+    ~StatsTable();
+
+    /**
+     * @param size the number of tids
+     * @return 0 on success, -1 if the array could not be mapped, then no statistics are kept
+     */
+    int init(int size);
+
+    /**
+     * @return the statistics of tid, nullptr when none are kept
+     */
+    ThreadStats* find(int tid) const
+    {
+        return table && tid >= 0 && (size_t) tid < length ? &table[tid] : nullptr;
+    }
+};
+
+#endif //UTHREADS_THREAD_STATS_H
@@ -0,0 +1,88 @@
+#include "tid_bitmap.h"
+
+#define WORD_BITS 64
+#define WORD_SHIFT 6
+#define BIT(i) (1ULL << ((i) & (WORD_BITS - 1)))
+
+/**
+ * builds the levels bottom up until a level fits in a single word, with every id in [0, size) free
+ * @param size the number of ids
+ */
+TidBitmap::TidBitmap(int size) : size(size)
+{
+    int bits = size;
+    do{
+        int words = (bits + WORD_BITS - 1) / WORD_BITS;
+        std::vector<uint64_t> level(words, ~0ULL);
+        if(bits % WORD_BITS){
+            level[words - 1] = BIT(bits) - 1;
+        }
+        levels.push_back(level);
+        bits = words;
+    }while(bits > 1);
+}
+
+int TidBitmap::lowest() const
+{
+    int id = 0;
+    for(int depth = (int) levels.size() - 1; depth >= 0; depth --){
+        uint64_t word = levels[depth][id];
+        if(!word){
+            return -1;
+        }
+        id = (id << WORD_SHIFT) + __builtin_ctzll(word);
+    }
+    return id;
+}
+
+/**
+ * the bits past size in the last word are clear, they look taken and are skipped by the bound on the result
+ */
+int TidBitmap::next_taken(int id) const
+{
+    const std::vector<uint64_t>& bottom = levels[0];
+    for(size_t i = id >> WORD_SHIFT; i < bottom.size(); i ++){
+        uint64_t taken = ~bottom[i];
+        if(i == (size_t) (id >> WORD_SHIFT)){
+            taken &= ~(BIT(id) - 1);
+        }
+        if(taken){
+            int found = (int) (i << WORD_SHIFT) + __builtin_ctzll(taken);
+            return found < size ? found : -1;
+        }
+    }
+    return -1;
+}
+
+/**
+ * marks id as used, and clears it from the upper levels when its word runs out of free ids
+ * @param id
+ */
+void TidBitmap::take(int id)
+{
+    for(size_t depth = 0; depth < levels.size(); depth ++){
+        uint64_t& word = levels[depth][id >> WORD_SHIFT];
+        word &= ~BIT(id);
+        if(word){
+            return;
+        }
+        id >>= WORD_SHIFT;
+    }
+}
+
+/**
+ * marks id as free, and sets it in the upper levels when its word had no free ids before
+ * @param id
+ */
+void TidBitmap::release(int id)
+{
+    for(size_t depth = 0; depth < levels.size(); depth ++){
+        uint64_t& word = levels[depth][id >> WORD_SHIFT];
+        bool was_empty = word == 0;
+        word |= BIT(id);
+        if(!was_empty){
+            return;
+        }
+        id >>= WORD_SHIFT;
+    }
+}
@@ -0,0 +1,36 @@
+#ifndef UTHREADS_TID_BITMAP_H
+#define UTHREADS_TID_BITMAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * hierarchical bitmap of free thread ids.
+ * a set bit in the bottom level means the id is free, a set bit in an upper level means the matching word one level
+ * down has at least one free id. finding the smallest free id walks one word per level with __builtin_ctzll, so
+ * with 64-bit words 64K ids need three words and 16M ids need four.
+ */
+class TidBitmap{
+    std::vector<std::vector<uint64_t>> levels;
+    int size;
+public :
+    explicit TidBitmap(int size);
+
+    /**
+     * @return the smallest free id, -1 if all ids are taken
+     */
+    int lowest() const;
+
+    /**
+     * @return the smallest id from id on that is taken, -1 if there is none. the bottom level is read a word at a time,
+     * so walking all the taken ids reads one bit per id instead of the threads themselves.
+     */
+    int next_taken(int id) const;
+
+    void take(int id);
+
+    void release(int id);
+};
+
+#endif //UTHREADS_TID_BITMAP_H
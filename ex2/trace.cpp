@@ -0,0 +1,271 @@
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "trace.h"
+#include "tsc.h"
+#include "scheduler.h"
+#include "uthreads.h"
+
+#define TRACE_BUFFER 4096 // bytes formatted before a write
+#define TRACE_PATH_MAX 64
+#define HEAD_STRIDE 8 // the heads of the rings are a cache line apart
+#define DUMP_END 1 // where a dump keeps the head of a worker it read, next to the head
+
+static_assert((UTHREADS_TRACE_EVENTS & (UTHREADS_TRACE_EVENTS - 1)) == 0, "the trace ring is a power of two");
+
+#ifdef UTHREADS_TRACE
+
+static uint64_t* heads = nullptr; // events recorded per worker, the next goes to slot head % UTHREADS_TRACE_EVENTS
+static TraceEvent* rings = nullptr; // UTHREADS_TRACE_EVENTS events per worker
+static int ring_count = 0;
+static int dumping = 0; // a dump is running, the buffer below is taken
+
+// the output of a dump. it is static so a dump in a signal handler does not need a large frame on a thread stack.
+static char buffer[TRACE_BUFFER];
+static size_t used;
+static int out_fd;
+static bool failed;
+
+static const char* const reason_names[] = {"spawn", "start", "schedule", "preempt", "yield", "block", "resume", "sleep",
+                                           "wake", "unpark", "terminate"};
+static const char* const status_names[] = {"RUNNING", "READY", "BLOCKED", "ZOMBIE"};
+
+/**
+ * the heads and the rings share one mapping, the heads first
+ */
+int Trace::init(int workers){
+    size_t heads_size = (size_t) workers * HEAD_STRIDE * sizeof(uint64_t);
+    size_t size = heads_size + (size_t) workers * UTHREADS_TRACE_EVENTS * sizeof(TraceEvent);
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(memory == MAP_FAILED){
+        return -1;
+    }
+    heads = (uint64_t*) memory;
+    rings = (TraceEvent*) ((char*) memory + heads_size);
+    ring_count = workers;
+    return 0;
+}
+
+/**
+ * the slot is cleared first and its seq set last, so a dump that reads it meanwhile sees it changed and skips it.
+ * the head is only written by its worker, the atomic store is for the dumps.
+ */
+void Trace::record(uint64_t tsc, int tid, int from, int to, int reason, int worker){
+    if(worker >= ring_count){
+        return;
+    }
+    uint64_t* head = &heads[worker * HEAD_STRIDE];
+    uint64_t index = *head;
+    __atomic_store_n(head, index + 1, __ATOMIC_RELAXED);
+    TraceEvent& event = rings[(size_t) worker * UTHREADS_TRACE_EVENTS + (index & (UTHREADS_TRACE_EVENTS - 1))];
+    __atomic_store_n(&event.seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    event.tsc = tsc;
+    event.tid = tid;
+    event.reason = (uint8_t) reason;
+    event.from = (uint8_t) from;
+    event.to = (uint8_t) to;
+    event.worker = (uint8_t) worker;
+    __atomic_store_n(&event.seq, index + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * copies the event with this index out of the ring of a worker
+ * @return false if it was overwritten or is being written
+ */
+static bool read_event(int worker, uint64_t index, TraceEvent* out){
+    TraceEvent& event = rings[(size_t) worker * UTHREADS_TRACE_EVENTS + (index & (UTHREADS_TRACE_EVENTS - 1))];
+    if(__atomic_load_n(&event.seq, __ATOMIC_ACQUIRE) != index + 1){
+        return false;
+    }
+    out->tsc = event.tsc;
+    out->tid = event.tid;
+    out->reason = event.reason;
+    out->from = event.from;
+    out->to = event.to;
+    out->worker = event.worker;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    out->seq = __atomic_load_n(&event.seq, __ATOMIC_RELAXED);
+    return out->seq == index + 1;
+}
+
+static void flush(){
+    size_t done = 0;
+    while(done < used && !failed){
+        ssize_t count = write(out_fd, buffer + done, used - done);
+        if(count > 0){
+            done += (size_t) count;
+        }else if(count == -1 && errno != EINTR){
+            failed = true;
+        }
+    }
+    used = 0;
+}
+
+static void put(const void* data, size_t size){
+    if(used + size > TRACE_BUFFER){
+        flush();
+    }
+    memcpy(buffer + used, data, size);
+    used += size;
+}
+
+static void put(const char* text){
+    put(text, strlen(text));
+}
+
+/**
+ * formats by hand, since snprintf is not async-signal-safe
+ * @param digits at least this many digits, padded with zeros
+ */
+static void put_number(long value, int digits = 1){
+    char text[24];
+    int length = 0;
+    bool negative = value < 0;
+    unsigned long rest = negative ? 0UL - (unsigned long) value : (unsigned long) value;
+    do{
+        text[sizeof(text) - 1 - length++] = (char) ('0' + rest % 10);
+        rest /= 10;
+    }while(rest || length < digits);
+    if(negative){
+        text[sizeof(text) - 1 - length++] = '-';
+    }
+    put(text + sizeof(text) - length, (size_t) length);
+}
+
+static const char* status_name(int status){
+    return status == TRACE_NO_STATUS ? "NONE" : status_names[status];
+}
+
+/**
+ * one Chrome trace event per status change, on the row of its thread: a switch to RUNNING begins a slice and a switch
+ * away from RUNNING ends it, so the rows show when every thread ran. the other changes are instant events.
+ */
+static void put_json_event(const TraceEvent& event, int pid){
+    const char* phase = "i";
+    if(event.to == RUNNING){
+        phase = "B";
+    }else if(event.from == RUNNING){
+        phase = "E";
+    }
+    long ns = Tsc::to_ns(event.tsc);
+    put("{\"name\":\"");
+    put(event.to == RUNNING ? "running" : reason_names[event.reason]);
+    put("\",\"cat\":\"uthreads\",\"ph\":\"");
+    put(phase);
+    put(*phase == 'i' ? "\",\"s\":\"t\",\"ts\":" : "\",\"ts\":");
+    put_number(ns / 1000);
+    put(".");
+    put_number(ns % 1000, 3);
+    put(",\"pid\":");
+    put_number(pid);
+    put(",\"tid\":");
+    put_number(event.tid);
+    put(",\"args\":{\"reason\":\"");
+    put(reason_names[event.reason]);
+    put("\",\"from\":\"");
+    put(status_name(event.from));
+    put("\",\"to\":\"");
+    put(status_name(event.to));
+    put("\",\"worker\":");
+    put_number(event.worker);
+    put("}}");
+}
+
+/**
+ * only one dump runs at a time, a dump that finds another one running fails instead of waiting for it, since the
+ * other one may be the thread or the signal handler it interrupted
+ */
+int Trace::dump(int fd, int format){
+    if(__atomic_exchange_n(&dumping, 1, __ATOMIC_ACQUIRE)){
+        return -1;
+    }
+    out_fd = fd;
+    used = 0;
+    failed = false;
+    int pid = (int) getpid();
+    uint64_t total = 0;
+    for(int worker = 0; worker < ring_count; worker ++){
+        uint64_t end = __atomic_load_n(&heads[worker * HEAD_STRIDE], __ATOMIC_ACQUIRE);
+        heads[worker * HEAD_STRIDE + DUMP_END] = end;
+        total += end < UTHREADS_TRACE_EVENTS ? end : UTHREADS_TRACE_EVENTS;
+    }
+    if(format == UTHREAD_TRACE_BINARY){
+        TraceHeader header;
+        memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+        header.event_size = sizeof(TraceEvent);
+        header.count = (uint32_t) total;
+        header.tsc_base = Tsc::tsc_base;
+        header.ns_base = Tsc::ns_base;
+        header.mult = Tsc::mult;
+        header.shift = TSC_SHIFT;
+        header.pid = (uint32_t) pid;
+        put(&header, sizeof(header));
+    }else{
+        put("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    }
+    bool first = true;
+    for(int worker = 0; worker < ring_count; worker ++){
+        uint64_t end = heads[worker * HEAD_STRIDE + DUMP_END];
+        for(uint64_t i = end > UTHREADS_TRACE_EVENTS ? end - UTHREADS_TRACE_EVENTS : 0; i < end; i ++){
+            TraceEvent event;
+            bool valid = read_event(worker, i, &event);
+            if(format == UTHREAD_TRACE_BINARY){
+                if(!valid){
+                    memset(&event, 0, sizeof(event));
+                }
+                put(&event, sizeof(event));
+            }else if(valid){
+                put(first ? "\n" : ",\n");
+                put_json_event(event, pid);
+                first = false;
+            }
+        }
+    }
+    if(format != UTHREAD_TRACE_BINARY){
+        put("]}\n");
+    }
+    flush();
+    bool ok = !failed;
+    __atomic_store_n(&dumping, 0, __ATOMIC_RELEASE);
+    return ok ? 0 : -1;
+}
+
+int Trace::dump_on_signal(){
+    char path[TRACE_PATH_MAX] = "uthreads-";
+    size_t length = strlen(path);
+    char digits[16];
+    int count = 0;
+    for(int pid = (int) getpid(); pid; pid /= 10){
+        digits[count++] = (char) ('0' + pid % 10);
+    }
+    while(count){
+        path[length++] = digits[--count];
+    }
+    strcpy(path + length, ".trace.json");
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd == -1){
+        return -1;
+    }
+    int result = dump(fd, UTHREAD_TRACE_JSON);
+    close(fd);
+    return result;
+}
+
+#else
+
+int Trace::init(int){
+    return 0;
+}
+
+int Trace::dump(int, int){
+    return -1;
+}
+
+int Trace::dump_on_signal(){
+    return -1;
+}
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef UTHREADS_TRACE_H
+#define UTHREADS_TRACE_H
+
+#include <cstdint>
+
+#ifndef UTHREADS_TRACE_EVENTS
+#define UTHREADS_TRACE_EVENTS 65536 // events the ring of a worker keeps, a power of two, the oldest are overwritten
+#endif
+
+#define TRACE_NO_STATUS 0xff // the status of a thread before it is spawned and after it is released
+#define TRACE_MAGIC "UTTRACE1"
+
+/**
+ * why a thread changed its status
+ */
+enum TraceReason {TRACE_SPAWN, TRACE_START, TRACE_SCHEDULE, TRACE_PREEMPT, TRACE_YIELD, TRACE_BLOCK, TRACE_RESUME,
+                  TRACE_SLEEP, TRACE_WAKE, TRACE_UNPARK, TRACE_TERMINATE};
+
+/**
+ * one status change: from and to are Status values or TRACE_NO_STATUS, tsc is a Tsc::read tick count
+ */
+struct TraceEvent{
+    uint64_t seq; // index of the event in the ring plus one, 0 while it is written
+    uint64_t tsc;
+    int32_t tid;
+    uint8_t reason;
+    uint8_t from;
+    uint8_t to;
+    uint8_t worker; // the low 8 bits of the index of the worker that recorded it
+};
+
+/**
+ * header of the binary format, followed by count TraceEvent records: those of worker 0 in the order they were
+ * recorded, then those of worker 1, and so on. a record whose seq is 0 was being written during the dump and holds
+ * nothing. the ticks convert to CLOCK_MONOTONIC nanoseconds as
+ * ns_base + ((tsc - tsc_base) * mult >> shift).
+ */
+struct TraceHeader{
+    char magic[8]; // TRACE_MAGIC, without a terminating zero
+    uint32_t event_size;
+    uint32_t count;
+    uint64_t tsc_base;
+    int64_t ns_base;
+    uint64_t mult;
+    uint32_t shift;
+    uint32_t pid;
+};
+
+/**
+ * fixed rings of the last UTHREADS_TRACE_EVENTS status changes the scheduler made on every worker, kept when the
+ * library is built with -DUTHREADS_TRACE.
+ * every worker records into its own ring, and only from inside the library, where the timer does not interrupt it, so
+ * taking a slot is a plain add and the workers never share a cache line. dumping only makes async-signal-safe calls, so
+ * it can run in a signal handler, and it skips the slots that are being written while it reads them.
+ */
+class Trace{
+public :
+    /**
+     * maps the rings, once before the first event
+     * @return 0 on success, -1 if they could not be mapped, then nothing is recorded
+     */
+    static int init(int workers);
+
+    /**
+     * @param tsc a Tsc::read tick count
+     */
+    static void record(uint64_t tsc, int tid, int from, int to, int reason, int worker);
+
+    /**
+     * writes the events the rings hold to fd
+     * @param format UTHREAD_TRACE_JSON or UTHREAD_TRACE_BINARY
+     * @return 0 on success, -1 if writing failed, another dump is running, or tracing is compiled out
+     */
+    static int dump(int fd, int format);
+
+    /**
+     * writes the events as Chrome trace JSON to uthreads-<pid>.trace.json in the working directory
+     * @return 0 on success, -1 otherwise
+     */
+    static int dump_on_signal();
+};
+
+#ifdef UTHREADS_TRACE
+#define TRACE_AT(tsc, tid, from, to, reason) \
+    Trace::record((tsc), (tid), (from), (to), (reason), Scheduler::self()->index)
+#else
+#define TRACE_AT(tsc, tid, from, to, reason) ((void) 0)
+#endif
+#define TRACE(tid, from, to, reason) TRACE_AT(Tsc::read(), tid, from, to, reason)
+
+#endif //UTHREADS_TRACE_H
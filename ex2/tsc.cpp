@@ -0,0 +1,57 @@
+#include <ctime>
+#ifdef __x86_64__
+#include <cpuid.h>
+#endif
+#include "tsc.h"
+
+#define NSEC_PER_SEC 1000000000L
+#define TSC_CALIBRATION_NS 200000 // how long the TSC is compared to CLOCK_MONOTONIC
+
+bool Tsc::invariant = false;
+uint64_t Tsc::tsc_base = 0;
+long Tsc::ns_base = 0;
+uint64_t Tsc::mult = 1ULL << TSC_SHIFT;
+
+long Tsc::monotonic(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/**
+ * compares the TSC to CLOCK_MONOTONIC for TSC_CALIBRATION_NS, if CPUID reports an invariant TSC
+ */
+void Tsc::calibrate(){
+#ifdef __x86_64__
+    unsigned eax, ebx, ecx, edx;
+    if(invariant || !__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || !(edx & (1U << 8))){
+        return;
+    }
+    long ns_start = monotonic();
+    uint64_t tsc_start = __rdtsc();
+    long ns_end;
+    uint64_t tsc_end;
+    do{
+        ns_end = monotonic();
+        tsc_end = __rdtsc();
+    }while(ns_end - ns_start < TSC_CALIBRATION_NS);
+    if(tsc_end <= tsc_start){
+        return;
+    }
+    mult = (uint64_t) (((unsigned __int128) (ns_end - ns_start) << TSC_SHIFT) / (tsc_end - tsc_start));
+    tsc_base = tsc_start;
+    ns_base = ns_start;
+    invariant = true;
+#endif
+}
+
+long Tsc::to_ns(uint64_t ticks){
+    if(!invariant){
+        return (long) ticks;
+    }
+    return ns_base + (long) (((unsigned __int128) (ticks - tsc_base) * mult) >> TSC_SHIFT);
+}
+
+long Tsc::now_ns(){
+    return to_ns(read());
+}
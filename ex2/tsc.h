@@ -0,0 +1,56 @@
+#ifndef UTHREADS_TSC_H
+#define UTHREADS_TSC_H
+
+#include <cstdint>
+#ifdef __x86_64__
+#include <x86intrin.h>
+#endif
+
+#define TSC_SHIFT 32 // fraction bits of the nanoseconds per tick
+
+/**
+ * the time stamp counter as a clock. reading it takes a fraction of a clock_gettime, which matters on every switch.
+ * it is only used when the CPU says it runs at a constant rate in every power state, and it is measured against
+ * CLOCK_MONOTONIC once when the library starts. without it the ticks are CLOCK_MONOTONIC nanoseconds.
+ * a tick count converts to nanoseconds as ns_base + ((ticks - tsc_base) * mult >> TSC_SHIFT), which also holds for
+ * the nanoseconds, with the bases at 0 and mult at 1 << TSC_SHIFT.
+ */
+class Tsc{
+public :
+    static bool invariant; // the ticks come from the TSC
+    static uint64_t tsc_base;
+    static long ns_base;
+    static uint64_t mult; // nanoseconds per tick, shifted left by TSC_SHIFT
+
+    /**
+     * measures the rate of the TSC, called once before the first read
+     */
+    static void calibrate();
+
+    static uint64_t read()
+    {
+#ifdef __x86_64__
+        if(invariant){
+            return __rdtsc();
+        }
+#endif
+        return (uint64_t) monotonic();
+    }
+
+    /**
+     * @return CLOCK_MONOTONIC in nanoseconds, read with clock_gettime
+     */
+    static long monotonic();
+
+    /**
+     * @return the CLOCK_MONOTONIC time of a tick count, in nanoseconds
+     */
+    static long to_ns(uint64_t ticks);
+
+    /**
+     * @return CLOCK_MONOTONIC in nanoseconds, read from the TSC when it is invariant
+     */
+    static long now_ns();
+};
+
+#endif //UTHREADS_TSC_H
@@ -7,16 +7,43 @@
 #include <vector>
 #include <csetjmp>
 #include "jmp.h"
+#include "chunked_array.h"
+#include "trace.h"
 #include <cstdio>
 #include <csignal>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
 #include <iostream>
 
 
 #define SIGACTION_ERROR "sigaction error\n"
 #define SET_TIMER_ERROR "set itimer error\n"
+#define CREATE_TIMER_ERROR "timer_create error\n"
+#define CREATE_WORKER_ERROR "pthread_create error\n"
 #define SYSTEM_CALL_ERROR "system error: "
 #define USEC_TO_SEC 1000000;
+#define TICKLESS_IDLE_QUANTA 1000 // how long the tickless timer is set for when no thread is sleeping
+#define LOCK_SPINS 100 // spins on the library lock before giving the CPU to the holder
+#define IO_RING_ENTRIES 256 // io_uring operations queued in one round
+#define IO_RING_MAX_LEN (1U << 30) // longest read or write handed to io_uring, longer ones come back short
+#define IDLE_STACK_SIZE (64 * 1024) // the idle thread of worker 0 makes the system calls that wait for events
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
 
 
 #define LIBRARY_ERROR "thread library error: "
@@ -27,340 +54,2143 @@ typedef void (*thread_entry_point)();
 static Scheduler *scheduler;
 struct sigaction sa = {0};
 struct itimerval timer;
-sigset_t set;
 
-sigjmp_buf* env;
+static ChunkedArray<thread_context>* env;
+static thread_context* idle_env; // contexts of the idle threads, one per worker
+static int quantum_length; // quantum_usecs given to uthread_init
+static int workers = 1; // kernel threads running the threads
+static volatile int library_lock = 0; // serializes the library calls of the workers when workers > 1
+// state that a thread reads on both sides of a switch, like holding the library lock, lives in its Worker and is read
+// through Scheduler::self() after the switch, since the thread may come back on another kernel thread.
+// in_library and preempt_pending belong to the kernel thread and its signal handler, so they stay thread_local. with
+// the initial-exec model every access on x86 is relative to the segment register of the kernel thread that makes it,
+// at any optimization level and with -fPIC, so no address of another kernel thread's copy is reused after a switch.
+// elsewhere the compiler may keep that address across a switch, and the library runs a single worker.
+#if defined(__x86_64__) || defined(__i386__)
+#define WORKER_LOCAL static thread_local __attribute__((tls_model("initial-exec")))
+#define MIGRATION_SAFE_TLS true
+#else
+#define WORKER_LOCAL static thread_local
+#define MIGRATION_SAFE_TLS false
+#endif
+WORKER_LOCAL volatile sig_atomic_t in_library = 0; // depth of the library calls the running thread is inside
+WORKER_LOCAL volatile sig_atomic_t preempt_pending = 0; // the timer fired while in_library was set
+static long missed_quanta = 0; // all the missed ticks that were counted
+static int clock_source = UTHREAD_CLOCK_VIRTUAL;
+static int timer_signal = SIGVTALRM; // the signal the timer sends
+static sigset_t timer_set; // only timer_signal
+static bool posix_timer = false; // the timer is a timer_create timer on CLOCK_MONOTONIC instead of an interval timer
+static bool tickless = false;
+static bool deadlock_reported = false; // the idle thread found every thread blocked, and said so once
+static bool oneshot = false; // the timer is set to fire once, oneshot_quanta quantums after it was set
+static long oneshot_quanta;
+static long oneshot_credited; // the quantums of the one-shot interval that were already counted
+static long oneshot_carry; // microseconds of the current quantum that passed, when the quantums were last counted
+
+void credit_quanta();
+void update_timer();
+
+int preempt(bool yielded = false);
+
+/**
+ * takes the library lock that serializes the workers. a holder may be preempted by the kernel, so after a short spin
+ * the waiter gives up its CPU instead of burning the holder's time slice.
+ */
+static void lock_library(){
+    int spins = 0;
+    while(__atomic_exchange_n(&library_lock, 1, __ATOMIC_ACQUIRE)){
+        while(__atomic_load_n(&library_lock, __ATOMIC_RELAXED)){
+            if(++spins == LOCK_SPINS){
+                sched_yield();
+                spins = 0;
+            }
+        }
+    }
+    Scheduler::self()->holding_lock = true;
+}
+
+/**
+ * @return true if the library lock was free and is now held by the calling worker
+ */
+static bool try_lock_library(){
+    if(__atomic_exchange_n(&library_lock, 1, __ATOMIC_ACQUIRE)){
+        return false;
+    }
+    Scheduler::self()->holding_lock = true;
+    return true;
+}
+
+static void unlock_library(){
+    Scheduler::self()->holding_lock = false;
+    __atomic_store_n(&library_lock, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * enters a library critical section without the library lock.
+ * the timer handler does not switch threads while the running thread is inside the library, it only records that a
+ * preemption is due, so entering and leaving cost no system call. in tickless mode the quantums a one-shot timer let
+ * pass are not counted here either, but only where the count is read or the timer is set again.
+ * preemption and uthread_yield only enter this way: with more than one worker the deques and the thread locks are
+ * enough to switch threads, so the workers do not wait for each other on every quantum.
+ */
+static void enter_library(){
+    in_library += 1;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+}
 
+/**
+ * enters a library critical section.
+ * with more than one worker the outermost call also takes the library lock, which guards everything but the deques:
+ * the sleepers, the wait queues, the stacks and the tids. it is held across a switch and released by the thread that
+ * is switched in, so no other worker reuses the stack or the tid of a thread that terminated before it is switched
+ * away from.
+ */
 void mask_alarm(){
-    sigprocmask(SIG_BLOCK, &set, NULL);
+    enter_library();
+    if(workers > 1 && in_library == 1){
+        lock_library();
+    }
 }
 
+/**
+ * leaves a library critical section, and makes the preemption the timer asked for while the thread was inside it
+ */
 void unmask_alarm() {
-    sigprocmask(SIG_UNBLOCK, &set, NULL);
+    if(tickless){
+        update_timer();
+    }
+    while(true){
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+        if(in_library == 1 && Scheduler::self()->holding_lock){
+            unlock_library();
+        }
+        in_library -= 1;
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+        if(in_library != 0 || !preempt_pending){
+            return;
+        }
+        in_library += 1;
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+        preempt_pending = 0;
+        if(oneshot){ // if the timer was set to fire once, this was it
+            credit_quanta();
+        }
+        oneshot = false;
+        preempt();
+        if(tickless){
+            update_timer();
+        }
+    }
+}
+
+/**
+ * @return the thread that makes the call.
+ * the running thread is read inside the library: with more than one worker a thread preempted between reading its
+ * worker and reading the worker's running thread may resume on another worker, and would read a thread of the old one.
+ */
+static Thread* current_thread(){
+    enter_library();
+    Thread* thread = scheduler->running();
+    unmask_alarm();
+    return thread;
 }
 /**
  * this function returns the first tid available
  * @return tid on success -1 otherwise
  */
 int get_new_tid() {
-    for(int i = 0; i < MAX_THREAD_NUM; i ++){
-        if(scheduler->allThreads[i].tid == -1){
-            return i;
+    return scheduler->get_new_tid();
+}
+
+/**
+ * @return the interval timer of the clock source, ITIMER_VIRTUAL, ITIMER_PROF or ITIMER_REAL
+ */
+static int itimer_which(){
+    switch(clock_source){
+        case UTHREAD_CLOCK_PROF:
+            return ITIMER_PROF;
+        case UTHREAD_CLOCK_REAL:
+            return ITIMER_REAL;
+        default:
+            return ITIMER_VIRTUAL;
+    }
+}
+
+/**
+ * @return true if the clock source does not advance while the process waits in the kernel
+ */
+static bool cpu_clock(){
+    return !posix_timer && clock_source != UTHREAD_CLOCK_REAL;
+}
+
+/**
+ * sets the timer of the calling worker to fire after first microseconds, and every interval after that unless it is 0
+ */
+static void set_timer(long first, long interval){
+    if(posix_timer){
+        struct itimerspec spec;
+        spec.it_value.tv_sec = first/USEC_TO_SEC;
+        spec.it_value.tv_nsec = first%USEC_TO_SEC;
+        spec.it_value.tv_nsec *= 1000L;
+        spec.it_interval.tv_sec = interval/USEC_TO_SEC;
+        spec.it_interval.tv_nsec = interval%USEC_TO_SEC;
+        spec.it_interval.tv_nsec *= 1000L;
+        if (timer_settime(Scheduler::self()->timer, 0, &spec, NULL))
+        {
+            fprintf(stderr, SYSTEM_CALL_ERROR SET_TIMER_ERROR);
+        }
+        return;
+    }
+
+    timer.it_value.tv_sec = first/USEC_TO_SEC;        // first time interval, seconds part
+    timer.it_value.tv_usec = first%USEC_TO_SEC;        // first time interval, microseconds part
+
+    timer.it_interval.tv_sec = interval/USEC_TO_SEC;    // following time intervals, seconds part
+    timer.it_interval.tv_usec = interval%USEC_TO_SEC;    // following time intervals, microseconds part
+
+    // Start an interval timer. The virtual one counts down whenever this process is executing.
+    if (setitimer(itimer_which(), &timer, NULL))
+    {
+        fprintf(stderr, SYSTEM_CALL_ERROR SET_TIMER_ERROR);
+    }
+}
+
+/**
+ * @return the microseconds left until the timer of the calling worker fires, -1 on failure
+ */
+static long timer_left(){
+    if(posix_timer){
+        struct itimerspec spec;
+        if (timer_gettime(Scheduler::self()->timer, &spec))
+        {
+            fprintf(stderr, SYSTEM_CALL_ERROR SET_TIMER_ERROR);
+            return -1;
+        }
+        long left = spec.it_value.tv_sec * USEC_TO_SEC;
+        return left + spec.it_value.tv_nsec / 1000;
+    }
+    struct itimerval left;
+    if (getitimer(itimer_which(), &left))
+    {
+        fprintf(stderr, SYSTEM_CALL_ERROR SET_TIMER_ERROR);
+        return -1;
+    }
+    long remaining = left.it_value.tv_sec * USEC_TO_SEC;
+    return remaining + left.it_value.tv_usec;
+}
+
+/**
+ * sets the timer to fire every slice quantums.
+ * called when the library starts and whenever the next thread has a different slice than the one the timer is set to
+ * with more than one worker it sets the timer of the calling worker
+ * a one-shot timer that is replaced was counted just before, and the part of the current quantum that already passed
+ * is taken off the first interval.
+ * @param slice
+ */
+void arm_timer(int slice){
+    long interval = (long) quantum_length * slice;
+    set_timer(oneshot ? interval - oneshot_carry : interval, interval);
+    Scheduler::self()->armed_slice = slice;
+    oneshot = false;
+}
+
+/**
+ * creates the timer of the calling worker. it sends SIGVTALRM to this kernel thread only, and runs on
+ * CLOCK_MONOTONIC so an idle worker keeps counting quantums and waking sleepers.
+ * a single worker uses it with UTHREAD_CLOCK_MONOTONIC.
+ * @return 0 on success -1 otherwise
+ */
+static int create_worker_timer(){
+    struct sigevent event = {};
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = SIGVTALRM;
+    event.sigev_notify_thread_id = (pid_t) syscall(SYS_gettid);
+    if (timer_create(CLOCK_MONOTONIC, &event, &Scheduler::self()->timer))
+    {
+        fprintf(stderr, SYSTEM_CALL_ERROR CREATE_TIMER_ERROR);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * sets the timer to fire once, after n quantums, and not again.
+ * a one-shot timer that is replaced was counted just before, and the part of the current quantum that already passed
+ * is taken off, so setting the timer again does not stretch the quantum.
+ * @param n
+ */
+void arm_oneshot(long n){
+    long interval = (long) quantum_length * n;
+    set_timer(oneshot ? interval - oneshot_carry : interval, 0);
+    Scheduler::self()->armed_slice = 0;
+    oneshot = true;
+    oneshot_quanta = n;
+    oneshot_credited = 0;
+}
+
+/**
+ * counts the quantums that passed since the one-shot timer was set, as if the timer had fired on each of them.
+ * the last quantum of the interval is left to the switch that the timer signal causes.
+ * it costs a system call, so it is only called where the count is read or the timer is set again.
+ */
+void credit_quanta(){
+    long remaining = timer_left();
+    if(remaining == -1){
+        return;
+    }
+    long elapsed = oneshot_quanta * quantum_length - remaining; // since the start of the quantum the timer was set in
+    long passed = elapsed / quantum_length;
+    if(passed > oneshot_quanta - 1){
+        passed = oneshot_quanta - 1;
+    }
+    oneshot_carry = elapsed - passed * quantum_length;
+    if(oneshot_carry >= quantum_length){
+        oneshot_carry = quantum_length - 1;
+    }
+    if(passed > oneshot_credited){
+        scheduler->quantum += passed - oneshot_credited;
+        scheduler->running()->quantum += passed - oneshot_credited;
+        oneshot_credited = passed;
+        scheduler->wake_sleepers();
+    }
+}
+
+/**
+ * @return the quantums a one-shot timer should run for, until the next sleeper is due
+ */
+static long oneshot_length(){
+    long wake = scheduler->next_wake();
+    long n = wake == -1 ? TICKLESS_IDLE_QUANTA : wake - scheduler->quantum;
+    long deadline = scheduler->next_wake_us();
+    if(deadline != -1){
+        long left = (deadline - Scheduler::now_us() + quantum_length - 1) / quantum_length;
+        n = left < n ? left : n;
+    }
+    return n < 1 ? 1 : n;
+}
+
+/**
+ * picks the timer mode for the running thread:
+ * in tickless mode, when no other thread is ready the timer only has to fire when the next sleeper is due,
+ * otherwise it fires every slice of the running thread.
+ * a one-shot timer that fires early enough is kept. the quantums it let pass are not counted yet, so the ones it has
+ * left look as many too many as the quantum count is behind, and a sleeper due before it fires still shows.
+ */
+void update_timer(){
+    if(tickless && scheduler->is_readyVec_empty()){
+        long n = oneshot_length();
+        if(oneshot && n < oneshot_quanta - oneshot_credited){
+            credit_quanta();
+            n = oneshot_length();
+        }
+        if(!oneshot || n < oneshot_quanta - oneshot_credited){
+            arm_oneshot(n);
+        }
+        return;
+    }
+    if(oneshot || scheduler->running()->slice != Scheduler::self()->armed_slice){
+        if(oneshot){
+            credit_quanta();
+        }
+        arm_timer(scheduler->running()->slice);
+    }
+}
+
+/**
+ * @return the saved context of the thread
+ */
+static thread_context* context_of(Thread* thread){
+    if(scheduler->is_idle(thread)){
+        return &idle_env[thread->worker];
+    }
+    return &(*env)[thread->tid];
+}
+
+/**
+ * wakes the sleeping threads that are due and the threads whose file descriptor is ready. the sleep heap and the I/O
+ * queues are guarded by the library lock, so a worker that switches without it only wakes them if the lock is free
+ * right away, otherwise a later switch does.
+ * @param locked the calling worker holds the library lock
+ */
+static void wake_threads(bool locked){
+    if(locked || workers == 1){
+        scheduler->wake_sleepers();
+        scheduler->poll_io(0);
+    }
+    else if((scheduler->sleepers_due() || scheduler->io_waiting()) && try_lock_library()){
+        scheduler->wake_sleepers();
+        scheduler->poll_io(0);
+        unlock_library();
+    }
+}
+
+/**
+ * this function calls the jump function in jmp to switch to the running thread of the calling worker
+ * increases the scheduler->quantum, also by the timer ticks that were missed since the last switch, and wakes the
+ * sleeping threads that are due in the new quantum, and the threads whose I/O is ready
+ * with more than one worker the switched in thread publishes the thread that was switched away from, and takes or
+ * releases the library lock so it holds it exactly when it did when it was switched away from itself.
+ * an idle thread that is switched in while threads are waiting in the deques looks for one at once.
+ */
+void jump(void (*func)(thread_context *)) {
+    if(oneshot){
+        credit_quanta();
+    }
+    Worker* worker = Scheduler::self();
+    bool locked = worker->holding_lock;
+    int missed = worker->missed_ticks ? __atomic_exchange_n(&worker->missed_ticks, 0, __ATOMIC_RELAXED) : 0;
+    if(workers > 1){
+        __atomic_add_fetch(&scheduler->quantum, 1 + missed, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&missed_quanta, missed, __ATOMIC_RELAXED);
+    }else{
+        scheduler->quantum += 1 + missed;
+        missed_quanta += missed;
+    }
+    wake_threads(locked);
+    update_timer();
+    func(context_of(scheduler->running()));
+    scheduler->finish_switch();
+    if(Scheduler::self()->holding_lock != locked){ // the thread may be back on another worker
+        if(locked){
+            lock_library();
+        }else{
+            unlock_library();
+        }
+    }
+    if(workers > 1 && scheduler->is_idle(scheduler->running()) && !scheduler->is_readyVec_empty()){
+        preempt_pending = 1;
+    }
+    scheduler->running()->quantum += 1;
+}
+
+/**
+ * preempting the next thread :
+ * mask timer signals
+ * update quantum of the thread
+ * update the timer
+ * update the data structure and jump to the next thread.
+ * a thread that another worker terminated while it ran is terminated here instead.
+ * @param yielded the running thread gives up the CPU itself (uthread_yield), it is not preempted
+ * @return 0 upon success -1 upon failure
+ */
+int preempt(bool yielded){
+    Thread* thread = scheduler->running();
+    if(scheduler->io_queued()){
+        // every quantum (or yield) ends a round of io_uring operations, submitted together
+        if(workers == 1 || Scheduler::self()->holding_lock){
+            scheduler->submit_io();
+        }
+        else if(try_lock_library()){
+            scheduler->submit_io();
+            unlock_library();
+        }
+    }
+    if(thread->cancel){
+        if(!Scheduler::self()->holding_lock){
+            lock_library();
+        }
+        scheduler->terminate(thread->tid);
+        jump(&jump_to_thread);
+    }
+    scheduler->preempt(yielded);
+    jump(&yield);
+    return 0;
+}
+
+/**
+ * switches to the head of the ready queue right away if it has a higher priority than the running thread.
+ * called with the timer signal masked, after a thread became READY.
+ */
+void preempt_if_needed(){
+    if(scheduler->should_preempt()){
+        preempt();
+    }
+}
+
+/**
+ * first function of every spawned thread: it is entered from a switch made inside the library, so it leaves the
+ * library first, then runs the thread's entry point, and terminates the thread if the entry point returns.
+ */
+static void start_thread(){
+    scheduler->finish_switch();
+    Thread* thread = scheduler->running();
+    unmask_alarm();
+    if(thread->start_routine){
+        uthread_exit(thread->start_routine(thread->arg));
+    }
+    thread->entry_point();
+    uthread_terminate(thread->tid);
+}
+
+/**
+ * waits in the kernel until some thread can become READY: the next sleeper is due, a file descriptor or an io_uring
+ * operation is ready, or a signal arrives. a CPU clock does not run while the process waits, so the quantums that
+ * passed meanwhile are counted from the monotonic clock instead, and the sleepers that are due are woken. a wall clock
+ * keeps firing, and its signal ends the wait.
+ * called by the idle thread of a single worker, inside the library.
+ */
+static void idle_wait(){
+    long wake = cpu_clock() ? scheduler->next_wake() : -1;
+    long deadline = scheduler->next_wake_us();
+    bool io = scheduler->io_waiting();
+    if(scheduler->next_wake() == -1 && deadline == -1 && !io){
+        if(!deadlock_reported){
+            fprintf(stderr, LIBRARY_ERROR "deadlock, every thread is blocked\n");
+            deadlock_reported = true;
+        }
+    }else{
+        deadlock_reported = false;
+    }
+    long start = Scheduler::now_us();
+    long timeout = -1; // microseconds
+    if(wake != -1){
+        timeout = wake > scheduler->quantum ? (wake - scheduler->quantum) * quantum_length : 0;
+    }
+    if(deadline != -1){
+        long left = deadline > start ? deadline - start : 0;
+        timeout = timeout == -1 || left < timeout ? left : timeout;
+    }
+    if(io){
+        scheduler->poll_io(timeout);
+    }else{
+        struct timespec wait;
+        wait.tv_sec = timeout / USEC_TO_SEC;
+        wait.tv_nsec = (timeout % 1000000) * 1000;
+        ppoll(nullptr, 0, timeout == -1 ? nullptr : &wait, nullptr);
+    }
+    if(wake != -1){
+        scheduler->quantum += (Scheduler::now_us() - start) / quantum_length;
+    }
+    scheduler->wake_sleepers();
+}
+
+/**
+ * the idle thread of a worker, which runs when the worker has no READY thread.
+ * with more than one worker it waits for signals outside the library, so the timer of the worker switches to any
+ * thread that was put in the queue of the worker meanwhile. a single worker waits for the event that makes a thread
+ * READY instead, and switches to it right away, so the process uses no CPU while every thread waits.
+ */
+static void idle_loop(){
+    while(true){
+        if(workers > 1){
+            pause();
+            continue;
+        }
+        mask_alarm();
+        if(scheduler->is_readyVec_empty()){
+            idle_wait();
+        }
+        if(!scheduler->is_readyVec_empty()){
+            preempt();
+        }
+        unmask_alarm();
+    }
+}
+
+/**
+ * first function of the idle thread of worker 0, which is entered from a switch made inside the library
+ */
+static void start_idle(){
+    scheduler->finish_switch();
+    unmask_alarm();
+    idle_loop();
+}
+
+/**
+ * entry point of the kernel threads of workers 1 and up. their own stack becomes the stack of their idle thread.
+ * @param arg the index of the worker
+ */
+static void* worker_main(void* arg){
+    int index = (int) (long) arg;
+    scheduler->enter_worker(index);
+    set_current_context(&idle_env[index]);
+    if(create_worker_timer() == 0){
+        arm_timer(1);
+    }
+    idle_loop();
+    return nullptr;
+}
+
+/**
+ * sets up the idle threads. the one of worker 0 gets its own stack, the other workers run theirs on the stack of
+ * their kernel thread.
+ * @return 0 on success -1 otherwise
+ */
+static int setup_idle(){
+    idle_env = new thread_context[workers]();
+    size_t idle_stack_size = StackPool::stack_size(IDLE_STACK_SIZE);
+    char* idle_stack = (char*) malloc(idle_stack_size);
+    if(!idle_stack){
+        fprintf(stderr, SYSTEM_CALL_ERROR "ERROR ALLOCATING MEMORY");
+        return -1;
+    }
+    setup_thread(&idle_env[0], idle_stack, &start_idle, idle_stack_size);
+    return 0;
+}
+
+/**
+ * starts a kernel thread for every worker but the calling one
+ * @return 0 on success -1 otherwise
+ */
+static int start_workers(){
+    for(int i = 1; i < workers; i ++){
+        pthread_t worker;
+        if(pthread_create(&worker, NULL, &worker_main, (void*) (long) i)){
+            fprintf(stderr, SYSTEM_CALL_ERROR CREATE_WORKER_ERROR);
+            return -1;
+        }
+        pthread_detach(worker);
+    }
+    return 0;
+}
+
+/**
+ * creates a thread with the given stack size and priority, see uthread_spawn_ex and uthread_spawn_prio.
+ * with a start_routine the thread is joinable and runs start_routine(arg), see uthread_create
+ * @return the tid of the new thread on success -1 otherwise
+ */
+int spawn_thread(thread_entry_point entry_point, int stack_size, int priority,
+                 uthread_start_routine start_routine = nullptr, void* arg = nullptr){
+    mask_alarm();
+    int tid = get_new_tid();
+    if(tid == -1 || tid >= scheduler->thread_limit()) {
+        fprintf(stderr, LIBRARY_ERROR "you reached the max number of threads\n");
+        unmask_alarm();
+        return -1;
+    }
+    if(entry_point == nullptr ){
+        fprintf(stderr, LIBRARY_ERROR "The entry_point should not be a null pointer\n");
+        unmask_alarm();
+        return -1;}
+    if(stack_size < 0){
+        fprintf(stderr, LIBRARY_ERROR "The stack_size should not be negative\n");
+        unmask_alarm();
+        return -1;}
+    if(env->ensure(tid) == -1){
+        fprintf(stderr, SYSTEM_CALL_ERROR "ERROR ALLOCATING MEMORY");
+        unmask_alarm();
+        return -1;}
+    if(scheduler->spawn(tid ,entry_point, stack_size, priority)==-1){
+        unmask_alarm();
+        return -1;}
+    if(start_routine){
+        scheduler->allThreads[tid].start_routine = start_routine;
+        scheduler->allThreads[tid].arg = arg;
+        scheduler->allThreads[tid].detached = false;
+    }
+    setup_thread(&(*env)[tid], scheduler->allThreads[tid].stack, &start_thread, scheduler->allThreads[tid].stack_size);
+    scheduler->start(tid);
+    preempt_if_needed();
+    unmask_alarm();
+    return tid;
+}
+
+/**
+ * handles the timer signals (SIGVTALRM, or SIGPROF or SIGALRM for the interval timers of those clocks).
+ * a tick that starts no quantum is counted as missed: the timer expired again before its signal was handled, or it
+ * fired while a preemption was already pending. the signals that wake an idle worker are no ticks.
+ * the kernel blocks the signal while the handler runs, until the handler unblocks it to switch threads: the thread
+ * switched to may not return through a handler, and must run with the signal unblocked. a tick that comes after that
+ * finds the library entered, and only records that a preemption is due. so at most one handler nests on another,
+ * however late the kernel thread runs the handlers, and the stack of a thread holds them.
+ * @param info tells the timer ticks from the signals sent by the library
+ */
+void timer_handler(int, siginfo_t* info, void*)
+{
+    in_library += 1;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    int saved_errno = errno; // the threads switched to meanwhile change it
+    Worker* worker = Scheduler::self();
+    if(worker == nullptr){ // the main thread was terminated, and the library released
+        return;
+    }
+    bool tick = info->si_code != SI_TKILL && info->si_code != SI_USER;
+    if(info->si_code == SI_TIMER){
+        int overrun = timer_getoverrun(worker->timer); // expirations after this signal was sent and before it came
+        if(overrun > 0){
+            __atomic_add_fetch(&worker->missed_ticks, overrun, __ATOMIC_RELAXED);
+        }
+    }
+    if(in_library > 1){
+        if(preempt_pending && tick){
+            __atomic_add_fetch(&worker->missed_ticks, 1, __ATOMIC_RELAXED); // two ticks, one preemption
         }
+        preempt_pending = 1;
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+        in_library -= 1;
+        errno = saved_errno;
+        return;
+    }
+    if(oneshot){
+        credit_quanta();
+    }
+    oneshot = false; // a one-shot timer that fired is not armed anymore
+    pthread_sigmask(SIG_UNBLOCK, &timer_set, NULL);
+    preempt();
+    unmask_alarm();
+    errno = saved_errno;
+}
+
+
+/**
+ * @return true if sig can dump the trace: tracing is built in and sig is a signal the library does not use itself
+ */
+static bool trace_signal_usable(int sig){
+#ifdef UTHREADS_TRACE
+    return sig > 0 && sig < NSIG && sig != SIGKILL && sig != SIGSTOP && sig != SIGVTALRM && sig != SIGPROF &&
+           sig != SIGALRM;
+#else
+    (void) sig;
+    return false;
+#endif
+}
+
+/**
+ * dumps the trace to uthreads-<pid>.trace.json. it runs inside the library, like timer_handler, so the timer does not
+ * switch threads halfway through the dump, and it only makes async-signal-safe calls.
+ */
+static void trace_handler(int)
+{
+    int saved_errno = errno;
+    enter_library();
+    Trace::dump_on_signal();
+    unmask_alarm();
+    errno = saved_errno;
+}
+
+/**
+ * SA_NODEFER: the handler may switch threads when it leaves the library, and the thread switched to must not find the
+ * signal blocked
+ */
+static int install_trace_signal(int sig){
+    struct sigaction action = {};
+    action.sa_handler = &trace_handler;
+    action.sa_flags = SA_NODEFER | SA_RESTART;
+    if(sigaction(sig, &action, NULL) < 0){
+        fprintf(stderr, SYSTEM_CALL_ERROR SIGACTION_ERROR);
+        return -1;
+    }
+    return 0;
+}
+
+
+int init_time(int quantum_usecs){
+
+    // Install timer_handler as the signal handler for the signal of the clock source.
+    // The signal is blocked while the handler runs, and the handler unblocks it before it switches threads.
+    sigemptyset(&timer_set);
+    sigaddset(&timer_set, timer_signal);
+    sa.sa_sigaction = &timer_handler;
+    sa.sa_flags = SA_SIGINFO;
+    if (sigaction(timer_signal, &sa, NULL) < 0)
+    {
+        fprintf(stderr,SYSTEM_CALL_ERROR SIGACTION_ERROR);
+    }
+
+    quantum_length = quantum_usecs;
+    if(posix_timer && create_worker_timer() == -1){
+        return -1;
+    }
+    arm_timer(1);
+
+    return 0;
+}
+
+/**
+ * @brief initializes the thread library.
+ *
+ * Once this function returns, the main thread (tid == 0) will be set as RUNNING. There is no need to
+ * provide an entry_point or to create a stack for the main thread - it will be using the "regular" stack and PC.
+ * You may assume that this function is called before any other thread library function, and that it is called
+ * exactly once.
+ * The input to the function is the length of a quantum in micro-seconds.
+ * It is an error to call this function with non-positive quantum_usecs.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_init(int quantum_usecs){
+    uthread_config config = {0};
+    config.quantum_usecs = quantum_usecs;
+    return uthread_init_ex(&config);
+}
+
+/**
+ * @brief initializes the thread library with the limits in config instead of MAX_THREAD_NUM and STACK_SIZE.
+ *
+ * The thread table and the saved contexts start empty and grow as threads are spawned, so max_threads only bounds
+ * the number of concurrent threads. A zero max_threads or stack_size means MAX_THREAD_NUM or STACK_SIZE.
+ * With workers > 1 the threads run on that many kernel threads, each with its own timer and work-stealing deque.
+ * With io_uring set, uthread_read, uthread_write and uthread_fsync go through io_uring if the kernel allows it.
+ * clock picks the timer that drives the quantums, a CPU clock (the default) or a wall clock. Sub-millisecond quantums
+ * need UTHREAD_CLOCK_MONOTONIC. timer_slack_ns, if set, is the timer slack of the kernel threads.
+ * trace_signal, if set, dumps the scheduler trace of a library built with -DUTHREADS_TRACE.
+ * It is an error to call this function with non-positive quantum_usecs or negative limits, or with an unknown clock or
+ * one that is process wide and more than one worker, with UTHREAD_SCHED_FAIR and more than one worker, or with a
+ * trace_signal that cannot be used.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_init_ex(const uthread_config* config){
+    if(config == nullptr){
+        fprintf(stderr, LIBRARY_ERROR "The config should not be a null pointer\n");
+        return -1;
+    }
+    if(config->quantum_usecs <= 0){
+      fprintf(stderr, LIBRARY_ERROR "The value of quantum_usecs should be greater than 0\n");
+      return -1;
+    }
+    if(config->max_threads < 0 || config->stack_size < 0){
+        fprintf(stderr, LIBRARY_ERROR "max_threads and stack_size should not be negative\n");
+        return -1;
+    }
+    if(config->sched_policy != UTHREAD_SCHED_PRIORITY && config->sched_policy != UTHREAD_SCHED_FAIR){
+        fprintf(stderr, LIBRARY_ERROR "unknown sched_policy\n");
+        return -1;
+    }
+    if(config->workers < 0 || (config->workers > 1 && config->tickless)){
+        fprintf(stderr, LIBRARY_ERROR "workers should not be negative, and tickless needs a single worker\n");
+        return -1;
+    }
+    if(config->workers > 1 && config->sched_policy == UTHREAD_SCHED_FAIR){
+        fprintf(stderr, LIBRARY_ERROR "the fair policy needs a single worker\n");
+        return -1;
+    }
+    if(config->workers > 1 && !MIGRATION_SAFE_TLS){
+        fprintf(stderr, LIBRARY_ERROR "more than one worker is only supported on x86\n");
+        return -1;
+    }
+    if(config->timer_slack_ns < 0){
+        fprintf(stderr, LIBRARY_ERROR "timer_slack_ns should not be negative\n");
+        return -1;
+    }
+    if(config->trace_signal && !trace_signal_usable(config->trace_signal)){
+        fprintf(stderr, LIBRARY_ERROR "trace_signal is not a signal, is a timer signal, or tracing is not built in\n");
+        return -1;
+    }
+    if(config->clock < UTHREAD_CLOCK_VIRTUAL || config->clock > UTHREAD_CLOCK_MONOTONIC ||
+       (config->workers > 1 && (config->clock == UTHREAD_CLOCK_PROF || config->clock == UTHREAD_CLOCK_REAL))){
+        fprintf(stderr, LIBRARY_ERROR "unknown clock, or a process wide clock with more than one worker\n");
+        return -1;
+    }
+    tickless = config->tickless != 0;
+    workers = config->workers ? config->workers : 1;
+    clock_source = config->clock;
+    posix_timer = workers > 1 || clock_source == UTHREAD_CLOCK_MONOTONIC;
+    if(clock_source == UTHREAD_CLOCK_PROF){
+        timer_signal = SIGPROF;
+    }else if(clock_source == UTHREAD_CLOCK_REAL){
+        timer_signal = SIGALRM;
+    }
+    int max_threads = config->max_threads ? config->max_threads : MAX_THREAD_NUM;
+    int stack_size = config->stack_size ? config->stack_size : STACK_SIZE;
+    scheduler = new Scheduler(max_threads, stack_size, config->sched_policy, workers);
+    env = new ChunkedArray<thread_context>();
+    env->reserve(max_threads);
+    if(setup_idle() == -1){
+        return -1;
+    }
+    if(env->ensure(0) == -1){
+        fprintf(stderr, SYSTEM_CALL_ERROR "ERROR ALLOCATING MEMORY");
+        exit(1);
+    }
+    set_current_context(&(*env)[0]);
+    if(scheduler->spawn(0, nullptr, 0, UTHREAD_DEFAULT_PRIORITY) == -1){
+        return -1;
+    }
+    scheduler->start(0);
+    if(scheduler->schedule() == 0){
+        // the workers inherit the slack of the kernel thread that creates them
+        if(config->timer_slack_ns && prctl(PR_SET_TIMERSLACK, (unsigned long) config->timer_slack_ns) == -1){
+            fprintf(stderr, SYSTEM_CALL_ERROR "prctl error\n");
+            return -1;
+        }
+        if(init_time(config->quantum_usecs) == -1){
+            return -1;
+        }
+        scheduler->quantum += 1;
+        if(tickless){
+            update_timer();
+        }
+        if(workers > 1 && start_workers() == -1){
+            return -1;
+        }
+        if(config->io_uring){
+            scheduler->setup_ring(IO_RING_ENTRIES); // without io_uring the I/O calls use the poll path
+        }
+        if(config->trace_signal && install_trace_signal(config->trace_signal) == -1){
+            return -1;
+        }
+        return 0;}
+    else{return -1;}
+}
+
+/**
+ * @brief Creates a new thread, whose entry point is the function entry_point with the signature
+ * void entry_point(void).
+ *
+ * The thread is added to the end of the READY threads list.
+ * The uthread_spawn function should fail if it would cause the number of concurrent threads to exceed the
+ * limit (MAX_THREAD_NUM).
+ * Each thread should be allocated with a stack of size STACK_SIZE bytes.
+ * It is an error to call this function with a null entry_point.
+ *
+ * @return On success, return the ID of the created thread. On failure, return -1.
+*/
+int uthread_spawn(thread_entry_point entry_point){
+    return uthread_spawn_ex(entry_point, 0);
+}
+
+/**
+ * @brief Creates a new thread like uthread_spawn, with a stack of stack_size bytes.
+ *
+ * A zero stack_size gives the thread the default stack size from uthread_init_ex.
+ * It is an error to call this function with a null entry_point or a negative stack_size.
+ *
+ * @return On success, return the ID of the created thread. On failure, return -1.
+*/
+int uthread_spawn_ex(thread_entry_point entry_point, int stack_size){
+    return spawn_thread(entry_point, stack_size, UTHREAD_DEFAULT_PRIORITY);
+}
+
+/**
+ * @brief Creates a new thread like uthread_spawn, at the given priority.
+ *
+ * Every priority level has its own READY queue. The next thread to run is always taken from the front of the highest
+ * priority (lowest number) level that is not empty, and threads of the same priority share the CPU round-robin.
+ * If the new thread has a higher priority than the calling thread, the caller is moved to the READY queue and the new
+ * thread runs at once.
+ * It is an error to call this function with a null entry_point or a priority outside [0, UTHREAD_PRIORITY_LEVELS),
+ * or with more than one worker.
+ *
+ * @return On success, return the ID of the created thread. On failure, return -1.
+*/
+int uthread_spawn_prio(thread_entry_point entry_point, int priority){
+    if(workers > 1){
+        fprintf(stderr, LIBRARY_ERROR "priorities need a single worker\n");
+        return -1;
+    }
+    if(priority < 0 || priority >= UTHREAD_PRIORITY_LEVELS){
+        fprintf(stderr, LIBRARY_ERROR "The priority should be between 0 and UTHREAD_PRIORITY_LEVELS - 1\n");
+        return -1;
+    }
+    return spawn_thread(entry_point, 0, priority);
+}
+
+/**
+ * @brief Changes the priority of the thread with ID tid.
+ *
+ * A READY thread moves to the end of the READY queue of its new priority. If this leaves a READY thread with a higher
+ * priority than the RUNNING one, the RUNNING thread is preempted right away.
+ * It is an error if no thread with ID tid exists, if priority is outside [0, UTHREAD_PRIORITY_LEVELS), or with more
+ * than one worker.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_set_priority(int tid, int priority){
+    if(workers > 1){
+        fprintf(stderr, LIBRARY_ERROR "priorities need a single worker\n");
+        return -1;
+    }
+    if(priority < 0 || priority >= UTHREAD_PRIORITY_LEVELS){
+        fprintf(stderr, LIBRARY_ERROR "The priority should be between 0 and UTHREAD_PRIORITY_LEVELS - 1\n");
+        return -1;
+    }
+    mask_alarm();
+    if(scheduler->set_priority(tid, priority) == -1){
+        fprintf(stderr, LIBRARY_ERROR "no thread with ID tid exists\n");
+        unmask_alarm();
+        return -1;
+    }
+    preempt_if_needed();
+    unmask_alarm();
+    return 0;
+}
+
+
+/**
+ * @brief Sets the weight of the thread with ID tid under UTHREAD_SCHED_FAIR.
+ *
+ * Under the fair policy every thread gets CPU time in proportion to its weight: a thread of weight 2048 runs twice
+ * as long as a thread of weight 1024 (UTHREAD_DEFAULT_WEIGHT). Priorities are ignored by this policy, and the weight
+ * is ignored by UTHREAD_SCHED_PRIORITY.
+ * It is an error if no thread with ID tid exists, if weight is outside [1, UTHREAD_MAX_WEIGHT], or with more than
+ * one worker.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_set_weight(int tid, int weight){
+    if(workers > 1){
+        fprintf(stderr, LIBRARY_ERROR "weights need a single worker\n");
+        return -1;
+    }
+    if(weight < 1 || weight > UTHREAD_MAX_WEIGHT){
+        fprintf(stderr, LIBRARY_ERROR "The weight should be between 1 and UTHREAD_MAX_WEIGHT\n");
+        return -1;
+    }
+    mask_alarm();
+    if(scheduler->set_weight(tid, weight) == -1){
+        fprintf(stderr, LIBRARY_ERROR "no thread with ID tid exists\n");
+        unmask_alarm();
+        return -1;
+    }
+    unmask_alarm();
+    return 0;
+}
+
+/**
+ * @brief Sets the length of the quantums of the thread with ID tid to slice times quantum_usecs.
+ *
+ * A thread with a longer slice is preempted by the timer less often. Each of its turns still counts as a single
+ * quantum in uthread_get_total_quantums, uthread_get_quantums and uthread_sleep. Under UTHREAD_SCHED_FAIR a turn
+ * costs the thread slice times as much of its share, so a longer slice means fewer and longer turns, not more CPU.
+ * The new slice takes effect the next time the thread is switched in.
+ * It is an error if no thread with ID tid exists or if slice is outside [1, UTHREAD_MAX_SLICE].
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_set_slice(int tid, int slice){
+    if(slice < 1 || slice > UTHREAD_MAX_SLICE){
+        fprintf(stderr, LIBRARY_ERROR "The slice should be between 1 and UTHREAD_MAX_SLICE\n");
+        return -1;
+    }
+    mask_alarm();
+    Thread* thread = scheduler->find(tid);
+    if(!thread){
+        fprintf(stderr, LIBRARY_ERROR "no thread with ID tid exists\n");
+        unmask_alarm();
+        return -1;
+    }
+    thread->slice = slice;
+    unmask_alarm();
+    return 0;
+}
+
+
+/**
+ * @brief Terminates the thread with ID tid and deletes it from all relevant control structures.
+ *
+ * All the resources allocated by the library for this thread should be released. If no thread with ID tid exists it
+ * is considered an error. Terminating the main thread (tid == 0) will result in the termination of the entire
+ * process using exit(0) (after releasing the assigned library memory).
+ *
+ * @return The function returns 0 if the thread was successfully terminated and -1 otherwise. If a thread terminates
+ * itself or the main thread is terminated, the function does not return.
+*/
+int uthread_terminate(int tid){
+    mask_alarm();
+    if(!scheduler->find(tid)){
+        std::cerr << LIBRARY_ERROR<< "no thread with ID tid exists" << std::endl;
+        unmask_alarm();
+        return -1;}
+    else if(tid == 0){
+        if(workers > 1){
+            exit(0); // the other workers may still be using the library memory
+        }
+        set_timer(0, 0); // a signal that is still pending finds no worker, and ignores it
+        delete scheduler;
+        delete env;
+        exit(0);
+    }
+    Thread* thread = &scheduler->allThreads[tid];
+    if(thread == scheduler->running()) {
+        scheduler->terminate(tid);
+        jump(&jump_to_thread);
+    }else if(scheduler->stop(thread)){
+        scheduler->terminate(tid);
+    } // else another worker runs it, and terminates it at the end of its quantum
+    unmask_alarm();
+    return 0;
+}
+
+
+/**
+ * @brief Blocks the thread with ID tid. The thread may be resumed later using uthread_resume.
+ *
+ * If no thread with ID tid exists it is considered as an error. In addition, it is an error to try blocking the
+ * main thread (tid == 0). If a thread blocks itself, a scheduling decision should be made. Blocking a thread in
+ * BLOCKED state has no effect and is not considered an error.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_block(int tid){
+    mask_alarm();
+    if(!scheduler->find(tid)){
+        fprintf(stderr, LIBRARY_ERROR  "no thread with ID tid exists");
+        unmask_alarm();
+        return -1;
+    }
+    else if(tid == 0){
+        fprintf( stderr, LIBRARY_ERROR "cannot block the main thread");
+        unmask_alarm();
+        return -1;
+    }
+    if(scheduler->allThreads[tid].status == BLOCKED){
+        unmask_alarm();
+        return 0;
+    }
+    if(scheduler->running()->tid == tid){
+        scheduler->block(tid);
+        jump(&yield);
+        unmask_alarm(); // returning from a blocked position
+        return 0;
+    }
+    scheduler->block(tid);
+    unmask_alarm();
+    return 0;
+}
+
+
+/**
+ * @brief Resumes a blocked thread with ID tid and moves it to the READY state.
+ *
+ * Resuming a thread in a RUNNING or READY state has no effect and is not considered as an error. If no thread with
+ * ID tid exists it is considered an error.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_resume(int tid){
+    mask_alarm();
+    if(tid < 0 || tid >= scheduler->thread_limit()){
+        fprintf(stderr, LIBRARY_ERROR "no thread with this tid exists\n");
+        unmask_alarm();
+        return -1;
+    }
+    if (!scheduler->find(tid)){
+        fprintf(stderr,LIBRARY_ERROR "no thread to resume \n");
+        unmask_alarm();
+        return -1;
+    }
+    scheduler->resume(tid);
+    preempt_if_needed();
+    unmask_alarm();
+    return 0;
+}
+
+
+/**
+ * @brief Blocks the RUNNING thread for num_quantums quantums.
+ *
+ * Immediately after the RUNNING thread transitions to the BLOCKED state a scheduling decision should be made.
+ * After the sleeping time is over, the thread should go back to the end of the READY queue.
+ * If the thread which was just RUNNING should also be added to the READY queue, or if multiple threads wake up
+ * at the same time, the order in which they're added to the end of the READY queue doesn't matter.
+ * The number of quantums refers to the number of times a new quantum starts, regardless of the reason. Specifically,
+ * the quantum of the thread which has made the call to uthread_sleep isn’t counted.
+ * While no thread is READY the process waits in the kernel instead of running a CPU clock, and the quantums that
+ * pass meanwhile are counted from the wall clock.
+ * It is considered an error if the main thread (tid == 0) calls this function.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_sleep(int num_quantums){
+    if (num_quantums <= 0) {
+        fprintf(stderr, LIBRARY_ERROR "num_quantums must be equal or grater than 0.\n");
+        return -1;
+    }
+    mask_alarm();
+    int tid = scheduler->running()->tid;
+    if (tid <= 0) {
+        fprintf(stderr, LIBRARY_ERROR "can not put the main thread to sleep and can not exceed the max thread number\n");
+        unmask_alarm();
+        return -1;
+    }
+    if(oneshot){
+        credit_quanta(); // the thread wakes num_quantums after the current quantum
+    }
+    if(scheduler->sleep(tid, num_quantums) == 0){
+        jump(&yield);
+        unmask_alarm();
+        return 0;
+    }
+    unmask_alarm();
+    return -1;
+}
+
+
+/**
+ * @brief Blocks the RUNNING thread for usecs micro-seconds of CLOCK_MONOTONIC time.
+ *
+ * Like uthread_sleep, but the deadline does not depend on the quantum length or the clock source. The thread goes
+ * back to the end of the READY queue at the first quantum start after the deadline, or right at the deadline if no
+ * other thread was READY meanwhile.
+ * It is considered an error if the main thread (tid == 0) calls this function, or if usecs is not positive.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_sleep_us(long usecs){
+    if (usecs <= 0) {
+        fprintf(stderr, LIBRARY_ERROR "usecs must be greater than 0.\n");
+        return -1;
+    }
+    mask_alarm();
+    int tid = scheduler->running()->tid;
+    if (tid <= 0) {
+        fprintf(stderr, LIBRARY_ERROR "can not put the main thread to sleep\n");
+        unmask_alarm();
+        return -1;
+    }
+    if(scheduler->sleep_until(tid, Scheduler::now_us() + usecs) == 0){
+        jump(&yield);
+        unmask_alarm();
+        return 0;
+    }
+    unmask_alarm();
+    return -1;
+}
+
+
+/**
+ * @brief Moves the RUNNING thread to the end of the READY queue and switches to the next READY thread right away.
+ *
+ * The switch does not wait for the quantum to expire and does not go through the timer signal. The thread that is
+ * switched to starts a new quantum (counted like any other quantum start) and runs for the rest of the current timer
+ * interval. If no other thread is READY the function returns at once and the caller keeps its quantum.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_yield(){
+    enter_library();
+    if(scheduler->is_readyVec_empty()){
+        unmask_alarm();
+        return 0;
+    }
+    preempt(true);
+    unmask_alarm();
+    return 0;
+}
+
+
+/**
+ * @brief Returns the thread ID of the calling thread.
+ *
+ * @return The ID of the calling thread.
+*/
+int uthread_get_tid(){
+    return current_thread()->tid;
+}
+
+
+/**
+ * @brief Returns the total number of quantums since the library was initialized, including the current quantum.
+ *
+ * Right after the call to uthread_init, the value should be 1.
+ * Each time a new quantum starts, regardless of the reason, this number should be increased by 1.
+ *
+ * @return The total number of quantums.
+*/
+int uthread_get_total_quantums(){
+    if(tickless){
+        mask_alarm();
+        if(oneshot){
+            credit_quanta();
+        }
+        int total = scheduler->quantum;
+        unmask_alarm();
+        return total;
+    }
+    return scheduler->quantum;
+}
+
+
+/**
+ * @brief Returns the number of quantums whose timer tick was missed, because the timer expired again before its
+ * signal was handled (an overrun of a UTHREAD_CLOCK_MONOTONIC timer) or while a preemption was already pending.
+ *
+ * The missed quantums are counted by uthread_get_total_quantums and uthread_sleep as if they had started.
+ *
+ * @return The number of missed quantums.
+*/
+int uthread_get_missed_quantums(){
+    return (int) __atomic_load_n(&missed_quanta, __ATOMIC_RELAXED);
+}
+
+
+int uthread_get_quantums(int tid){
+    mask_alarm();
+    if (tid < 0){
+        fprintf(stderr, LIBRARY_ERROR "thread %d does not exist (no get quantums)\n",tid);
+        unmask_alarm();
+        return -1;
+    }
+    if(!scheduler->find(tid)){
+        fprintf(stderr, LIBRARY_ERROR "thread %d does not exist (no get quantums)\n",tid);
+        unmask_alarm();
+        return -1;
+    }
+    if(oneshot){
+        credit_quanta();
+    }
+    int quantums = (int) scheduler->allThreads[tid].quantum;
+    unmask_alarm();
+    return quantums;
+}
+
+
+/**
+ * @brief Fills stats with the scheduling statistics of the thread with ID tid, up to the time of the call.
+ *
+ * The switches and the RUNNING, READY and blocked times of every thread are recorded at every switch, without locks
+ * or allocation. A ZOMBIE thread keeps its statistics until it is joined.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_get_stats(int tid, uthread_stats *stats){
+    if(stats == nullptr){
+        fprintf(stderr, LIBRARY_ERROR "stats should not be a null pointer\n");
+        return -1;
+    }
+    mask_alarm();
+    if(scheduler->get_stats(tid, stats) == -1){
+        fprintf(stderr, LIBRARY_ERROR "thread %d does not exist (no stats)\n", tid);
+        unmask_alarm();
+        return -1;
+    }
+    unmask_alarm();
+    return 0;
+}
+
+
+/**
+ * @brief Fills stats with the scheduling statistics of the whole process, the threads that exist and those that
+ * terminated.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_get_process_stats(uthread_stats *stats){
+    if(stats == nullptr){
+        fprintf(stderr, LIBRARY_ERROR "stats should not be a null pointer\n");
+        return -1;
+    }
+    mask_alarm();
+    scheduler->get_process_stats(stats);
+    unmask_alarm();
+    return 0;
+}
+
+
+/**
+ * @brief Writes the scheduler trace to the file at path, in UTHREAD_TRACE_JSON or UTHREAD_TRACE_BINARY format.
+ *
+ * Only a library built with -DUTHREADS_TRACE records the trace. The dump takes no lock, the threads of the other
+ * workers keep recording while it is written.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_trace_dump(const char *path, int format){
+    if(path == nullptr || (format != UTHREAD_TRACE_JSON && format != UTHREAD_TRACE_BINARY)){
+        fprintf(stderr, LIBRARY_ERROR "path should not be a null pointer, and format should be known\n");
+        return -1;
+    }
+#ifndef UTHREADS_TRACE
+    fprintf(stderr, LIBRARY_ERROR "the library was built without -DUTHREADS_TRACE\n");
+    return -1;
+#else
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd == -1){
+        fprintf(stderr, SYSTEM_CALL_ERROR "open error\n");
+        return -1;
+    }
+    int result = Trace::dump(fd, format); // lock-free, the thread may be preempted while it writes
+    close(fd);
+    if(result == -1){
+        fprintf(stderr, LIBRARY_ERROR "the trace could not be written, or another dump is running\n");
+        return -1;
+    }
+    return 0;
+#endif
+}
+
+
+/**
+ * some other thread can still run while the running one waits: it is READY, or it is a sleeper or an I/O waiter the
+ * idle thread waits for. with more than one worker another worker may always run one.
+ * @return 1 if the running thread can wait, -1 if every other thread is blocked
+ */
+static int can_wait(){
+    if(workers > 1 || !scheduler->is_readyVec_empty()){
+        return 1;
+    }
+    bool sleepers = scheduler->next_wake() != -1 || scheduler->next_wake_us() != -1;
+    return !sleepers && !scheduler->io_waiting() ? -1 : 1;
+}
+
+/**
+ * @brief Creates a new joinable thread that runs start_routine(arg).
+ *
+ * The thread is added to the READY queue like a thread made by uthread_spawn, with the default stack size and
+ * priority. When start_routine returns, or the thread calls uthread_exit or is terminated, its stack is released but
+ * its ID stays in use until another thread collects the return value with uthread_join, or it is detached.
+ * Threads made by uthread_spawn are detached from the start.
+ * It is an error to call this function with a null start_routine.
+ *
+ * @return On success, return the ID of the created thread. On failure, return -1.
+*/
+int uthread_create(uthread_start_routine start_routine, void *arg){
+    if(start_routine == nullptr){
+        fprintf(stderr, LIBRARY_ERROR "The start_routine should not be a null pointer\n");
+        return -1;
+    }
+    return spawn_thread(&start_thread, 0, UTHREAD_DEFAULT_PRIORITY, start_routine, arg);
+}
+
+
+/**
+ * @brief Waits until the thread with ID tid terminates and releases its ID.
+ *
+ * If the thread already terminated the function returns at once. Otherwise the calling thread is BLOCKED and a
+ * scheduling decision is made; it moves to the READY queue when the thread terminates. If retval is not null, the
+ * value the thread returned or passed to uthread_exit (null if it was terminated) is stored in it.
+ * It is an error if no thread with ID tid exists, if it is detached, if it is the calling thread, or if another
+ * thread already waits for it.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_join(int tid, void **retval){
+    mask_alarm();
+    Thread* thread = scheduler->find_any(tid);
+    if(!thread){
+        fprintf(stderr, LIBRARY_ERROR "no thread with ID tid exists\n");
+        unmask_alarm();
+        return -1;
+    }
+    if(thread->detached || thread == scheduler->running() || !thread->joiners.empty()){
+        fprintf(stderr, LIBRARY_ERROR "the thread can not be joined\n");
+        unmask_alarm();
+        return -1;
+    }
+    while(thread->status != ZOMBIE){
+        int waiting = can_wait();
+        if(waiting == -1){
+            fprintf(stderr, LIBRARY_ERROR "deadlock, the thread can not terminate\n");
+            unmask_alarm();
+            return -1;
+        }
+        scheduler->wait_for(thread);
+        jump(&yield);
+    }
+    if(retval){
+        *retval = thread->retval;
+    }
+    scheduler->reap(tid);
+    unmask_alarm();
+    return 0;
+}
+
+
+/**
+ * @brief Detaches the thread with ID tid: its ID is released as soon as it terminates, and it can not be joined.
+ *
+ * Detaching a thread that already terminated releases its ID right away. Detaching a detached thread has no effect.
+ * It is an error if no thread with ID tid exists or if another thread waits for it.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_detach(int tid){
+    mask_alarm();
+    Thread* thread = scheduler->find_any(tid);
+    if(!thread){
+        fprintf(stderr, LIBRARY_ERROR "no thread with ID tid exists\n");
+        unmask_alarm();
+        return -1;
+    }
+    if(!thread->joiners.empty()){
+        fprintf(stderr, LIBRARY_ERROR "can not detach a thread another thread waits for\n");
+        unmask_alarm();
+        return -1;
+    }
+    thread->detached = true;
+    if(thread->status == ZOMBIE){
+        scheduler->reap(tid);
+    }
+    unmask_alarm();
+    return 0;
+}
+
+
+/**
+ * @brief Terminates the calling thread with the return value retval, which a thread joining it receives.
+ *
+ * Called by the main thread it ends the process like uthread_terminate(0). The function does not return.
+*/
+void uthread_exit(void *retval){
+    Thread* thread = current_thread();
+    thread->retval = retval;
+    uthread_terminate(thread->tid);
+}
+
+
+/**
+ * @brief Initializes mutex as unlocked.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_mutex_init(uthread_mutex_t *mutex){
+    if(mutex == nullptr){
+        fprintf(stderr, LIBRARY_ERROR "The mutex should not be a null pointer\n");
+        return -1;
+    }
+    mutex->state = 0;
+    __atomic_store_n(&mutex->owner, -1, __ATOMIC_RELAXED);
+    mutex->queue = -1;
+    return 0;
+}
+
+
+/**
+ * @brief Releases the library resources of mutex. It is an error to destroy a locked mutex.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_mutex_destroy(uthread_mutex_t *mutex){
+    if(mutex == nullptr){
+        fprintf(stderr, LIBRARY_ERROR "The mutex should not be a null pointer\n");
+        return -1;
+    }
+    mask_alarm();
+    if(mutex->state != 0){
+        fprintf(stderr, LIBRARY_ERROR "can not destroy a locked mutex\n");
+        unmask_alarm();
+        return -1;
+    }
+    if(mutex->queue != -1){
+        scheduler->free_wait_queue(mutex->queue);
+        mutex->queue = -1;
+    }
+    unmask_alarm();
+    return 0;
+}
+
+/**
+ * the slow path of the lock: the mutex was held when the running thread tried to take it.
+ * marks the mutex as contended and waits in its queue until the holder hands the mutex over.
+ * called with the timer signal masked.
+ * @return 0 on success -1 on a deadlock
+ */
+static int wait_for_mutex(uthread_mutex_t *mutex){
+    int tid = scheduler->running()->tid;
+    while(__atomic_exchange_n(&mutex->state, 2, __ATOMIC_ACQUIRE) != 0){
+        int waiting = can_wait();
+        if(waiting == -1){
+            fprintf(stderr, LIBRARY_ERROR "deadlock, no other thread can unlock the mutex\n");
+            return -1;
+        }
+        if(mutex->queue == -1){
+            mutex->queue = scheduler->new_wait_queue();
+        }
+        scheduler->park(mutex->queue);
+        jump(&yield);
+        if(__atomic_load_n(&mutex->owner, __ATOMIC_RELAXED) == tid){
+            return 0; // handed over by uthread_mutex_unlock
+        }
+    }
+    __atomic_store_n(&mutex->owner, tid, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/**
+ * the slow path of the unlock: some thread may be waiting for the mutex.
+ * hands the mutex to the first waiter, or leaves it unlocked if there is none.
+ * called with the timer signal masked, after the owner was cleared.
+ */
+static void hand_over(uthread_mutex_t *mutex){
+    Thread* next = mutex->queue == -1 ? nullptr : scheduler->unpark(mutex->queue);
+    if(!next){
+        __atomic_store_n(&mutex->state, 0, __ATOMIC_RELEASE);
+        return;
+    }
+    __atomic_store_n(&mutex->owner, next->tid, __ATOMIC_RELAXED);
+    if(scheduler->wait_queue_empty(mutex->queue)){
+        __atomic_store_n(&mutex->state, 1, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * unlocks a mutex the running thread holds.
+ * the common case, no waiters, is a single compare-and-swap without masking the timer signal
+ */
+static void release_mutex(uthread_mutex_t *mutex){
+    __atomic_store_n(&mutex->owner, -1, __ATOMIC_RELAXED);
+    int expected = 1;
+    if(__atomic_compare_exchange_n(&mutex->state, &expected, 0, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)){
+        return;
+    }
+    mask_alarm();
+    hand_over(mutex);
+    preempt_if_needed();
+    unmask_alarm();
+}
+
+
+/**
+ * @brief Locks mutex, waiting until it is unlocked if another thread holds it.
+ *
+ * Locking a mutex that no thread holds takes a single atomic instruction, with no signal masking and no system call.
+ * Otherwise the calling thread is BLOCKED and a scheduling decision is made. When the holder unlocks the mutex it is
+ * handed directly to the thread that waited the longest, which moves to the end of the READY queue.
+ * A thread waiting for a mutex is not released by uthread_resume. It is an error to lock a mutex the calling thread
+ * already holds, or to wait when no other thread is READY or sleeping.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_mutex_lock(uthread_mutex_t *mutex){
+    if(mutex == nullptr){
+        fprintf(stderr, LIBRARY_ERROR "The mutex should not be a null pointer\n");
+        return -1;
+    }
+    int tid = current_thread()->tid;
+    int expected = 0;
+    if(__atomic_compare_exchange_n(&mutex->state, &expected, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+        __atomic_store_n(&mutex->owner, tid, __ATOMIC_RELAXED);
+        return 0;
+    }
+    if(__atomic_load_n(&mutex->owner, __ATOMIC_RELAXED) == tid){
+        fprintf(stderr, LIBRARY_ERROR "the thread already holds the mutex\n");
+        return -1;
+    }
+    mask_alarm();
+    int ret = wait_for_mutex(mutex);
+    unmask_alarm();
+    return ret;
+}
+
+
+/**
+ * @brief Locks mutex if no thread holds it, without waiting.
+ *
+ * @return If the mutex was locked by the call, return 0. Otherwise return -1.
+*/
+int uthread_mutex_trylock(uthread_mutex_t *mutex){
+    if(mutex == nullptr){
+        fprintf(stderr, LIBRARY_ERROR "The mutex should not be a null pointer\n");
+        return -1;
+    }
+    int expected = 0;
+    if(__atomic_compare_exchange_n(&mutex->state, &expected, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+        __atomic_store_n(&mutex->owner, current_thread()->tid, __ATOMIC_RELAXED);
+        return 0;
+    }
+    return -1;
+}
+
+
+/**
+ * @brief Unlocks mutex, handing it to the next waiting thread if there is one.
+ *
+ * It is an error to unlock a mutex that the calling thread does not hold.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_mutex_unlock(uthread_mutex_t *mutex){
+    if(mutex == nullptr){
+        fprintf(stderr, LIBRARY_ERROR "The mutex should not be a null pointer\n");
+        return -1;
+    }
+    if(__atomic_load_n(&mutex->owner, __ATOMIC_RELAXED) != current_thread()->tid){
+        fprintf(stderr, LIBRARY_ERROR "the thread does not hold the mutex\n");
+        return -1;
+    }
+    release_mutex(mutex);
+    return 0;
+}
+
+
+/**
+ * @brief Initializes cond with no waiting threads.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_cond_init(uthread_cond_t *cond){
+    if(cond == nullptr){
+        fprintf(stderr, LIBRARY_ERROR "The cond should not be a null pointer\n");
+        return -1;
+    }
+    cond->queue = -1;
+    return 0;
+}
+
+
+/**
+ * @brief Releases the library resources of cond. It is an error to destroy a condition variable threads wait on.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_cond_destroy(uthread_cond_t *cond){
+    if(cond == nullptr){
+        fprintf(stderr, LIBRARY_ERROR "The cond should not be a null pointer\n");
+        return -1;
+    }
+    mask_alarm();
+    if(cond->queue != -1){
+        if(!scheduler->wait_queue_empty(cond->queue)){
+            fprintf(stderr, LIBRARY_ERROR "can not destroy a condition variable threads wait on\n");
+            unmask_alarm();
+            return -1;
+        }
+        scheduler->free_wait_queue(cond->queue);
+        cond->queue = -1;
+    }
+    unmask_alarm();
+    return 0;
+}
+
+
+/**
+ * @brief Unlocks mutex and waits on cond, then locks mutex again before returning.
+ *
+ * The calling thread must hold mutex. Unlocking and starting to wait happen together, so a signal sent after the
+ * caller unlocked the mutex is not lost. As with any condition variable, the caller should check its condition
+ * again after the call returns.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_cond_wait(uthread_cond_t *cond, uthread_mutex_t *mutex){
+    if(cond == nullptr || mutex == nullptr){
+        fprintf(stderr, LIBRARY_ERROR "The cond and the mutex should not be null pointers\n");
+        return -1;
+    }
+    mask_alarm();
+    if(__atomic_load_n(&mutex->owner, __ATOMIC_RELAXED) != scheduler->running()->tid){
+        fprintf(stderr, LIBRARY_ERROR "the thread does not hold the mutex\n");
+        unmask_alarm();
+        return -1;
+    }
+    __atomic_store_n(&mutex->owner, -1, __ATOMIC_RELAXED);
+    int expected = 1;
+    if(!__atomic_compare_exchange_n(&mutex->state, &expected, 0, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)){
+        hand_over(mutex);
+    }
+    int waiting = can_wait();
+    if(waiting == -1){
+        fprintf(stderr, LIBRARY_ERROR "deadlock, no other thread can signal the condition\n");
     }
-    return -1;
-}
-
-void decrease_sleep(int tid){
-    for(int i = 0; i < MAX_THREAD_NUM; i ++){
-        if(scheduler->allThreads[i].tid != -1 && scheduler->allThreads[i].sleep > 0){
-//            if(i != tid){
-            scheduler->allThreads[i].sleep -= 1;
-//            }
-            if(scheduler->allThreads[i].is_sleep && scheduler->allThreads[i].sleep <= 0){
-                scheduler->exit_sleep(i);
-            }
+    else{
+        if(cond->queue == -1){
+            cond->queue = scheduler->new_wait_queue();
         }
+        scheduler->park(cond->queue);
+        jump(&yield);
     }
+    int ret = wait_for_mutex(mutex);
+    unmask_alarm();
+    return waiting == -1 ? -1 : ret;
 }
 
 /**
- * this function calls the jump function in jmp to switch between threads
- * increases the scheduler->quantum
- */
-void jump(int tid, void (*func)(int, sigjmp_buf *), int prevtid) {
-    decrease_sleep(prevtid);
-    scheduler->quantum += 1; // check
-    func(tid, env);
-    scheduler->running->quantum += 1;
-}
-
-/**
- * preempting the next thread :
- * mask timer signals
- * update quantum of the thread
- * update the timer
- * update the data structure and jump to the next thread.
- * @return 0 upon success -1 upon failure
+ * wakes up to count threads waiting on cond
  */
-int preempt(){
-    scheduler->preempt();
-    while(scheduler->running->sleep > 0){
-        scheduler->preempt();
+static int wake_waiters(uthread_cond_t *cond, int count){
+    if(cond == nullptr){
+        fprintf(stderr, LIBRARY_ERROR "The cond should not be a null pointer\n");
+        return -1;
+    }
+    if(cond->queue == -1){
+        return 0; // no thread ever waited on it
     }
-    jump(scheduler->running->tid, &yield, -1);
-    return 0;
-}
-
-/**
- * handles the timer signals (SIGVTALRM)
- * @param sig
- */
-void timer_handler(int sig)
-{
     mask_alarm();
-    preempt();
+    while(count-- > 0 && scheduler->unpark(cond->queue)){
+    }
+    preempt_if_needed();
     unmask_alarm();
+    return 0;
 }
 
 
-int init_time(int quantum_usecs){
-
-    // Install timer_handler as the signal handler for SIGVTALRM.
-    sa.sa_handler = &timer_handler;
-    if (sigaction(SIGVTALRM, &sa, NULL) < 0)
-    {
-        fprintf(stderr,SYSTEM_CALL_ERROR SIGACTION_ERROR);
-    }
-
-    int secs = quantum_usecs/USEC_TO_SEC;
-    int usecs = quantum_usecs%USEC_TO_SEC;
-
-    // Configure the timer to expire after 1 sec... */
-    timer.it_value.tv_sec = secs;        // first time interval, seconds part
-    timer.it_value.tv_usec = usecs;        // first time interval, microseconds part
-
-    // configure the timer to expire every 3 sec after that.
-    timer.it_interval.tv_sec = secs;    // following time intervals, seconds part
-    timer.it_interval.tv_usec = usecs;    // following time intervals, microseconds part
+/**
+ * @brief Moves the thread that waited the longest on cond to the end of the READY queue.
+ *
+ * Signaling a condition variable no thread waits on has no effect.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_cond_signal(uthread_cond_t *cond){
+    return wake_waiters(cond, 1);
+}
 
-    // Start a virtual timer. It counts down whenever this process is executing.
-    if (setitimer(ITIMER_VIRTUAL, &timer, NULL))
-    {
-        fprintf(stderr, SYSTEM_CALL_ERROR SET_TIMER_ERROR);
-    }
 
-    return 0;
+/**
+ * @brief Moves all the threads waiting on cond to the READY queue.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_cond_broadcast(uthread_cond_t *cond){
+    return wake_waiters(cond, scheduler->thread_limit());
 }
 
+
 /**
- * @brief initializes the thread library.
- *
- * Once this function returns, the main thread (tid == 0) will be set as RUNNING. There is no need to
- * provide an entry_point or to create a stack for the main thread - it will be using the "regular" stack and PC.
- * You may assume that this function is called before any other thread library function, and that it is called
- * exactly once.
- * The input to the function is the length of a quantum in micro-seconds.
- * It is an error to call this function with non-positive quantum_usecs.
+ * @brief Initializes chan as an empty channel for up to capacity messages of elem_size bytes.
  *
  * @return On success, return 0. On failure, return -1.
 */
-int uthread_init(int quantum_usecs){
-    sigemptyset(&set);
-    sigaddset(&set, SIGALRM);
-    if(quantum_usecs <= 0){
-      fprintf(stderr, LIBRARY_ERROR "The value of quantum_usecs should be greater than 0\n");
-      return -1;
+int uthread_chan_init(uthread_chan_t *chan, int capacity, size_t elem_size){
+    if(chan == nullptr || capacity < 0 || elem_size == 0){
+        fprintf(stderr, LIBRARY_ERROR "The chan should not be a null pointer, capacity should not be negative and "
+                                      "elem_size should not be 0\n");
+        return -1;
     }
-    scheduler = new Scheduler(MAX_THREAD_NUM, STACK_SIZE);
-    env = new sigjmp_buf[MAX_THREAD_NUM];
-    if(!env){
-        fprintf(stderr, SYSTEM_CALL_ERROR "ERROR ALLOCATING MEMORY");
-        exit(1);
+    char* buffer = nullptr;
+    if(capacity > 0){
+        if(elem_size > SIZE_MAX / (size_t) capacity){
+            fprintf(stderr, LIBRARY_ERROR "the channel is too large\n");
+            return -1;
+        }
+        buffer = (char*) malloc((size_t) capacity * elem_size);
+        if(!buffer){
+            fprintf(stderr, SYSTEM_CALL_ERROR "ERROR ALLOCATING MEMORY\n");
+            return -1;
+        }
     }
-    if(scheduler->spawn(0, nullptr) == 0 && scheduler->schedule() == 0){
-        init_time(quantum_usecs);
-        scheduler->quantum += 1;
-        return 0;}
-    else{return -1;}
+    chan->buffer = buffer;
+    chan->elem_size = elem_size;
+    chan->capacity = capacity;
+    chan->head = 0;
+    chan->count = 0;
+    chan->senders = -1;
+    chan->receivers = -1;
+    return 0;
 }
 
+
 /**
- * @brief Creates a new thread, whose entry point is the function entry_point with the signature
- * void entry_point(void).
+ * @brief Releases the buffer and the library resources of chan. It is an error to destroy a channel threads wait on.
  *
- * The thread is added to the end of the READY threads list.
- * The uthread_spawn function should fail if it would cause the number of concurrent threads to exceed the
- * limit (MAX_THREAD_NUM).
- * Each thread should be allocated with a stack of size STACK_SIZE bytes.
- * It is an error to call this function with a null entry_point.
- *
- * @return On success, return the ID of the created thread. On failure, return -1.
+ * @return On success, return 0. On failure, return -1.
 */
-int uthread_spawn(thread_entry_point entry_point){
+int uthread_chan_destroy(uthread_chan_t *chan){
+    if(chan == nullptr){
+        fprintf(stderr, LIBRARY_ERROR "The chan should not be a null pointer\n");
+        return -1;
+    }
     mask_alarm();
-    int tid = get_new_tid();
-    if(tid == -1 || tid >= MAX_THREAD_NUM) {
-        fprintf(stderr, LIBRARY_ERROR "you reached the max number of threads\n");
+    if((chan->senders != -1 && !scheduler->wait_queue_empty(chan->senders)) ||
+       (chan->receivers != -1 && !scheduler->wait_queue_empty(chan->receivers))){
+        fprintf(stderr, LIBRARY_ERROR "can not destroy a channel threads wait on\n");
         unmask_alarm();
         return -1;
     }
-    if(entry_point == nullptr ){
-        fprintf(stderr, LIBRARY_ERROR "The entry_point should not be a null pointer\n");
-        unmask_alarm();
-        return -1;}
-    if(scheduler->spawn(tid ,&entry_point)==-1){
-        return -1;}
-    setup_thread(tid, scheduler->allThreads[tid].stack,entry_point, env, STACK_SIZE);
+    if(chan->senders != -1){
+        scheduler->free_wait_queue(chan->senders);
+        chan->senders = -1;
+    }
+    if(chan->receivers != -1){
+        scheduler->free_wait_queue(chan->receivers);
+        chan->receivers = -1;
+    }
     unmask_alarm();
-    return tid;
+    free(chan->buffer);
+    chan->buffer = nullptr;
+    chan->count = 0;
+    return 0;
+}
+
+/**
+ * @return the message of chan that is index messages after the oldest one
+ */
+static char* chan_slot(uthread_chan_t *chan, int index){
+    return chan->buffer + (size_t) ((chan->head + index) % chan->capacity) * chan->elem_size;
+}
 
+/**
+ * parks the running thread in a wait queue of chan until the thread that wakes it copied its message, from data for
+ * a sender and to data for a receiver.
+ * called with the timer signal masked.
+ * @param queue chan->senders or chan->receivers, created on the first wait
+ * @return 0 on success -1 on a deadlock
+ */
+static int wait_on_chan(int *queue, void *data){
+    if(can_wait() == -1){
+        fprintf(stderr, LIBRARY_ERROR "deadlock, no other thread can use the channel\n");
+        return -1;
+    }
+    if(*queue == -1){
+        *queue = scheduler->new_wait_queue();
+    }
+    scheduler->running()->chan_data = data;
+    scheduler->park(*queue);
+    jump(&yield);
+    return 0;
 }
 
 
 /**
- * @brief Terminates the thread with ID tid and deletes it from all relevant control structures.
+ * @brief Sends the elem_size bytes at msg on chan, waiting for room if the channel is full.
  *
- * All the resources allocated by the library for this thread should be released. If no thread with ID tid exists it
- * is considered an error. Terminating the main thread (tid == 0) will result in the termination of the entire
- * process using exit(0) (after releasing the assigned library memory).
+ * A waiting receiver gets the message copied straight into its destination and runs at once.
  *
- * @return The function returns 0 if the thread was successfully terminated and -1 otherwise. If a thread terminates
- * itself or the main thread is terminated, the function does not return.
+ * @return On success, return 0. On failure, return -1.
 */
-int uthread_terminate(int tid){
+int uthread_chan_send(uthread_chan_t *chan, const void *msg){
+    if(chan == nullptr || msg == nullptr){
+        fprintf(stderr, LIBRARY_ERROR "The chan and the message should not be null pointers\n");
+        return -1;
+    }
     mask_alarm();
-    if(tid < 0 || tid >= MAX_THREAD_NUM || scheduler->allThreads[tid].tid == -1){
-        std::cerr << LIBRARY_ERROR<< "no thread with ID tid exists" << std::endl;
+    Thread* receiver = chan->receivers == -1 ? nullptr : scheduler->waiter(chan->receivers);
+    if(receiver){
+        // a receiver only waits while the channel is empty, so the message skips the buffer
+        memcpy(receiver->chan_data, msg, chan->elem_size);
+        receiver->chan_data = nullptr;
+        scheduler->hand_off(chan->receivers);
+        jump(&yield);
         unmask_alarm();
-        return -1;}
-    else if(tid == 0){
-        delete scheduler;
-        delete[] env;
-        exit(0);
+        return 0;
     }
-    if(scheduler->allThreads[tid].status == RUNNING && !scheduler->allThreads[tid].is_sleep) {
-        scheduler->terminate(tid);
-        jump(scheduler->running->tid, &jump_to_thread,-1);
-    }else{
-//        decrease_sleep(-1);
-        scheduler->terminate(tid);
+    if(chan->count < chan->capacity){
+        memcpy(chan_slot(chan, chan->count), msg, chan->elem_size);
+        chan->count += 1;
+        unmask_alarm();
+        return 0;
     }
+    int ret = wait_on_chan(&chan->senders, (void*) msg);
     unmask_alarm();
-    return 0;
+    return ret;
 }
 
 
 /**
- * @brief Blocks the thread with ID tid. The thread may be resumed later using uthread_resume.
+ * @brief Receives the oldest message of chan into the elem_size bytes at msg, waiting for one if the channel is empty.
  *
- * If no thread with ID tid exists it is considered as an error. In addition, it is an error to try blocking the
- * main thread (tid == 0). If a thread blocks itself, a scheduling decision should be made. Blocking a thread in
- * BLOCKED state has no effect and is not considered an error.
+ * The message of the sender that waited the longest takes the room that was made.
  *
  * @return On success, return 0. On failure, return -1.
 */
-int uthread_block(int tid){
-    mask_alarm();
-    if(tid < 0 || tid >= MAX_THREAD_NUM || scheduler->allThreads[tid].tid == -1){
-        fprintf(stderr, LIBRARY_ERROR  "no thread with ID tid exists");
-        unmask_alarm();
+int uthread_chan_recv(uthread_chan_t *chan, void *msg){
+    if(chan == nullptr || msg == nullptr){
+        fprintf(stderr, LIBRARY_ERROR "The chan and the message should not be null pointers\n");
         return -1;
     }
-    else if(tid == 0){
-        fprintf( stderr, LIBRARY_ERROR "cannot block the main thread");
-        unmask_alarm();
-        return -1;
+    mask_alarm();
+    // a sender only waits while the channel is full
+    Thread* sender = chan->senders == -1 ? nullptr : scheduler->waiter(chan->senders);
+    if(chan->count > 0){
+        memcpy(msg, chan_slot(chan, 0), chan->elem_size);
+        chan->head = (chan->head + 1) % chan->capacity;
+        chan->count -= 1;
+        if(sender){
+            memcpy(chan_slot(chan, chan->count), sender->chan_data, chan->elem_size);
+            chan->count += 1;
+        }
     }
-    if(scheduler->allThreads[tid].status == BLOCKED){
+    else if(sender){
+        memcpy(msg, sender->chan_data, chan->elem_size); // a channel with capacity 0
+    }
+    else{
+        int ret = wait_on_chan(&chan->receivers, msg);
         unmask_alarm();
-        return 0;
+        return ret;
     }
-    if(scheduler->running->tid == tid){
-        scheduler->block(tid);
-        jump(scheduler->running->tid, &yield, -1);
-        unmask_alarm(); // returning from a blocked position
-        return 0;
+    if(sender){
+        sender->chan_data = nullptr;
+        scheduler->unpark(chan->senders);
+        preempt_if_needed();
     }
-    scheduler->block(tid);
     unmask_alarm();
     return 0;
 }
 
 
 /**
- * @brief Resumes a blocked thread with ID tid and moves it to the READY state.
- *
- * Resuming a thread in a RUNNING or READY state has no effect and is not considered as an error. If no thread with
- * ID tid exists it is considered an error.
- *
- * @return On success, return 0. On failure, return -1.
-*/
-int uthread_resume(int tid){
+ * waits until fd is ready for reading or writing. the thread is parked until the scheduler finds fd ready in its
+ * epoll set, which it polls on every switch. when no other thread can run meanwhile, the idle thread waits in the
+ * kernel for the epoll set.
+ * called with the timer signal masked.
+ * @return 0 when the I/O should be tried again, -1 on failure
+ */
+static int wait_fd(int fd, bool write){
+    if(scheduler->park_io(fd, write ? EPOLLOUT : EPOLLIN) == -1){
+        return -1;
+    }
+    jump(&yield);
+    return 0;
+}
+
+/**
+ * called after an I/O call on fd failed
+ * @return true if the call should be tried again: it was interrupted, or it would have blocked and fd became ready
+ */
+static bool retry_io(int fd, bool write){
+    if(errno == EINTR){
+        return true;
+    }
+    if(errno != EAGAIN && errno != EWOULDBLOCK){
+        return false;
+    }
     mask_alarm();
-    if(tid < 0 || tid >= MAX_THREAD_NUM){
-        fprintf(stderr, LIBRARY_ERROR "no thread with this tid exists\n");
+    int ret = wait_fd(fd, write);
+    unmask_alarm();
+    return ret == 0;
+}
+
+/**
+ * runs an io_uring operation for the running thread. the thread is parked while the operation is queued, and the
+ * operations of all the threads are submitted together at the end of the quantum. when no other thread can run, the
+ * idle thread ends the round at once and waits for the completion in the kernel.
+ * @param result the result of the operation, -1 with errno set on failure
+ * @return 0 if the operation ran, -1 if io_uring is not used or its ring is full, then the poll path is taken
+ */
+static int ring_io(uint8_t op, int fd, void* buf, size_t len, ssize_t* result){
+    if(!scheduler->uses_ring()){
         return -1;
     }
-    if (scheduler->allThreads[tid].tid == -1){
-        fprintf(stderr,LIBRARY_ERROR "no thread to resume \n");
+    mask_alarm();
+    if(scheduler->queue_io(op, fd, buf, len > IO_RING_MAX_LEN ? IO_RING_MAX_LEN : (unsigned) len) == -1){
+        unmask_alarm();
         return -1;
     }
-    scheduler->resume(tid);
+    Thread* thread = scheduler->running();
+    while(thread->io_seq){
+        scheduler->park_ring();
+        jump(&yield);
+    }
+    int ret = thread->io_result;
     unmask_alarm();
+    if(ret < 0){
+        errno = -ret;
+        *result = -1;
+    }else{
+        *result = ret;
+    }
     return 0;
 }
 
+/**
+ * @return 0 on success, -1 if the flags of fd could not be read or changed
+ */
+static int set_nonblocking(int fd){
+    int flags = fcntl(fd, F_GETFL);
+    if(flags == -1){
+        return -1;
+    }
+    if(flags & O_NONBLOCK){
+        return 0;
+    }
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
 
 /**
- * @brief Blocks the RUNNING thread for num_quantums quantums.
+ * @brief Reads up to count bytes from fd like read(2), blocking only the calling thread.
  *
- * Immediately after the RUNNING thread transitions to the BLOCKED state a scheduling decision should be made.
- * After the sleeping time is over, the thread should go back to the end of the READY queue.
- * If the thread which was just RUNNING should also be added to the READY queue, or if multiple threads wake up
- * at the same time, the order in which they're added to the end of the READY queue doesn't matter.
- * The number of quantums refers to the number of times a new quantum starts, regardless of the reason. Specifically,
- * the quantum of the thread which has made the call to uthread_sleep isn’t counted.
- * It is considered an error if the main thread (tid == 0) calls this function.
+ * fd is switched to non-blocking mode. If no data is available the calling thread is BLOCKED and a scheduling
+ * decision is made; it moves to the READY queue once fd is readable. uthread_resume does not release it.
+ * With the io_uring engine the read is queued instead, and the thread is BLOCKED until it completes.
  *
- * @return On success, return 0. On failure, return -1.
+ * @return The number of bytes read, 0 at end of file. On failure, return -1 and set errno.
 */
-int uthread_sleep(int num_quantums){
-    int tid = scheduler->running->tid;
-    if (tid <= 0 || tid >= MAX_THREAD_NUM) {
-        fprintf(stderr, LIBRARY_ERROR "can not put the main thread to sleep and can not exceed the max thread number\n");
-        return -1;
+ssize_t uthread_read(int fd, void *buf, size_t count){
+    ssize_t ret;
+    if(ring_io(IORING_OP_READ, fd, buf, count, &ret) == 0 && (ret != -1 || errno != EAGAIN)){
+        return ret; // io_uring gives EAGAIN for a non-blocking fd with no data, that one is polled instead
     }
-    if (num_quantums <= 0) {
-        fprintf(stderr, LIBRARY_ERROR "num_quantums must be equal or grater than 0.\n");
+    if(set_nonblocking(fd) == -1){
         return -1;
     }
-    mask_alarm();
-    if(scheduler->sleep(tid, num_quantums) == 0){
-        jump(scheduler->running->tid, &yield, -1);
-        unmask_alarm();
-        return 0;
+    while(true){
+        ssize_t ret = read(fd, buf, count);
+        if(ret != -1 || !retry_io(fd, false)){
+            return ret;
+        }
     }
-    unmask_alarm();
-    return -1;
 }
 
 
 /**
- * @brief Returns the thread ID of the calling thread.
+ * @brief Writes up to count bytes to fd like write(2), blocking only the calling thread.
  *
- * @return The ID of the calling thread.
+ * fd is switched to non-blocking mode. If fd can not take any data the calling thread is BLOCKED until it is
+ * writable, as in uthread_read. Like write(2) it may write fewer than count bytes.
+ *
+ * @return The number of bytes written. On failure, return -1 and set errno.
 */
-int uthread_get_tid(){
-    return scheduler->running->tid;
+ssize_t uthread_write(int fd, const void *buf, size_t count){
+    ssize_t ret;
+    if(ring_io(IORING_OP_WRITE, fd, (void*) buf, count, &ret) == 0 && (ret != -1 || errno != EAGAIN)){
+        return ret;
+    }
+    if(set_nonblocking(fd) == -1){
+        return -1;
+    }
+    while(true){
+        ssize_t ret = write(fd, buf, count);
+        if(ret != -1 || !retry_io(fd, true)){
+            return ret;
+        }
+    }
 }
 
 
 /**
- * @brief Returns the total number of quantums since the library was initialized, including the current quantum.
+ * @brief Accepts a connection on the listening socket fd like accept(2), blocking only the calling thread.
  *
- * Right after the call to uthread_init, the value should be 1.
- * Each time a new quantum starts, regardless of the reason, this number should be increased by 1.
+ * fd is switched to non-blocking mode, and the calling thread is BLOCKED until a connection arrives, as in
+ * uthread_read. The new socket is left in blocking mode; uthread_read and uthread_write switch it when they use it.
  *
- * @return The total number of quantums.
+ * @return The file descriptor of the accepted socket. On failure, return -1 and set errno.
 */
-int uthread_get_total_quantums(){
-    return scheduler->quantum;
+int uthread_accept(int fd, struct sockaddr *addr, socklen_t *addrlen){
+    if(set_nonblocking(fd) == -1){
+        return -1;
+    }
+    while(true){
+        int ret = accept(fd, addr, addrlen);
+        if(ret != -1 || !retry_io(fd, false)){
+            return ret;
+        }
+    }
 }
 
 
-int uthread_get_quantums(int tid){
-    mask_alarm();
-    if (tid < 0){
-        fprintf(stderr, LIBRARY_ERROR "thread %d does not exist (no get quantums)\n",tid);
-        unmask_alarm();
+/**
+ * @brief Connects the socket fd to addr like connect(2), blocking only the calling thread.
+ *
+ * fd is switched to non-blocking mode, and the calling thread is BLOCKED until the connection is established or
+ * fails, as in uthread_read.
+ *
+ * @return On success, return 0. On failure, return -1 and set errno.
+*/
+int uthread_connect(int fd, const struct sockaddr *addr, socklen_t addrlen){
+    if(set_nonblocking(fd) == -1){
         return -1;
     }
-    if(scheduler->allThreads[tid].tid == -1){
-        fprintf(stderr, LIBRARY_ERROR "thread %d does not exist (no get quantums)\n",tid);
-        unmask_alarm();
+    if(connect(fd, addr, addrlen) == 0){
+        return 0;
+    }
+    if(errno != EINPROGRESS && errno != EINTR){
         return -1;
     }
-    unmask_alarm();
-    return scheduler->allThreads[tid].quantum;
+    struct pollfd connecting = {fd, POLLOUT, 0};
+    while(poll(&connecting, 1, 0) != 1){
+        // a thread is woken whenever fd is ready, but some other thread may have been the reason it was armed
+        errno = EAGAIN;
+        if(!retry_io(fd, true)){
+            return -1;
+        }
+    }
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if(getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) == -1){
+        return -1;
+    }
+    if(error){
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Flushes fd to its storage device like fsync(2), blocking only the calling thread.
+ *
+ * With the io_uring engine the calling thread is BLOCKED until the flush completes. Without it the whole process
+ * waits in fsync(2), since a regular file can not be polled.
+ *
+ * @return On success, return 0. On failure, return -1 and set errno.
+*/
+int uthread_fsync(int fd){
+    ssize_t ret;
+    if(ring_io(IORING_OP_FSYNC, fd, nullptr, 0, &ret) == 0){
+        return (int) ret;
+    }
+    return fsync(fd);
 }
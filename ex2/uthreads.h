@@ -0,0 +1,649 @@
+/*
+ * User-Level Threads Library (uthreads)
+ * Hebrew University OS course.
+ * Author: OS, os@cs.huji.ac.il
+ */
+
+#ifndef _UTHREADS_H
+#define _UTHREADS_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#define MAX_THREAD_NUM 100 /* maximal number of threads */
+#define STACK_SIZE 4096 /* stack size per thread (in bytes) */
+#define UTHREAD_PRIORITY_LEVELS 32 /* number of priority levels, 0 is the highest priority */
+#define UTHREAD_DEFAULT_PRIORITY 16 /* priority of the main thread and of threads spawned without one */
+#define UTHREAD_DEFAULT_WEIGHT 1024 /* CPU share of a thread under UTHREAD_SCHED_FAIR */
+#define UTHREAD_MAX_WEIGHT 65536
+#define UTHREAD_MAX_SLICE 1000 /* longest slice, in quantums */
+
+/* scheduling policies for uthread_config::sched_policy */
+#define UTHREAD_SCHED_PRIORITY 0 /* strict priority levels, round-robin inside a level */
+#define UTHREAD_SCHED_FAIR 1 /* stride scheduling, CPU time proportional to the thread weights */
+
+/* clocks that drive the quantums, for uthread_config::clock */
+#define UTHREAD_CLOCK_VIRTUAL 0 /* ITIMER_VIRTUAL, user CPU time of the process */
+#define UTHREAD_CLOCK_PROF 1 /* ITIMER_PROF, user and system CPU time of the process */
+#define UTHREAD_CLOCK_REAL 2 /* ITIMER_REAL, wall-clock time, sends SIGALRM */
+#define UTHREAD_CLOCK_MONOTONIC 3 /* timer_create on CLOCK_MONOTONIC, signals the kernel thread that called init */
+
+/* formats of uthread_trace_dump */
+#define UTHREAD_TRACE_JSON 0 /* Chrome trace event JSON, opens in Perfetto or chrome://tracing */
+#define UTHREAD_TRACE_BINARY 1 /* TraceHeader and TraceEvent records, see trace.h */
+
+typedef void (*thread_entry_point)(void);
+
+typedef void *(*uthread_start_routine)(void *);
+
+/* Library configuration for uthread_init_ex. Zeroed fields take their default values. */
+typedef struct uthread_config {
+    int quantum_usecs; /* length of a quantum in micro-seconds */
+    int max_threads; /* maximal number of concurrent threads, MAX_THREAD_NUM by default */
+    int stack_size; /* stack size of threads spawned with uthread_spawn (in bytes), STACK_SIZE by default */
+    int sched_policy; /* UTHREAD_SCHED_PRIORITY by default */
+    int tickless; /* nonzero: no timer signal every quantum while a single thread is runnable */
+    int workers; /* number of kernel threads that run the threads, 1 by default */
+    int io_uring; /* nonzero: uthread_read, uthread_write and uthread_fsync use io_uring when the kernel has it */
+    int clock; /* UTHREAD_CLOCK_VIRTUAL by default */
+    int timer_slack_ns; /* timer slack of the kernel threads (prctl PR_SET_TIMERSLACK), 0 keeps the kernel default */
+    int trace_signal; /* nonzero: this signal dumps the trace to uthreads-<pid>.trace.json, needs -DUTHREADS_TRACE */
+} uthread_config;
+
+/* Mutex, a thread that waits for it gives up the CPU until the lock is handed to it. Initialize with
+ * UTHREAD_MUTEX_INITIALIZER or uthread_mutex_init. */
+typedef struct uthread_mutex {
+    int state; /* 0 unlocked, 1 locked, 2 locked and some thread may be waiting */
+    int owner; /* tid of the thread holding the lock, -1 when unlocked, read and written atomically */
+    int queue; /* wait queue in the library, -1 until a thread first waits */
+} uthread_mutex_t;
+
+#define UTHREAD_MUTEX_INITIALIZER {0, -1, -1}
+
+/* Condition variable. Initialize with UTHREAD_COND_INITIALIZER or uthread_cond_init. */
+typedef struct uthread_cond {
+    int queue; /* wait queue in the library, -1 until a thread first waits */
+} uthread_cond_t;
+
+#define UTHREAD_COND_INITIALIZER {-1}
+
+/* Bounded channel of messages of a fixed size, see uthread_chan_send. Initialize with uthread_chan_init, C++ code can
+ * use the Channel template of channel.h instead. */
+typedef struct uthread_chan {
+    char *buffer; /* capacity messages, a ring that starts at head, null when capacity is 0 */
+    size_t elem_size; /* size of a message in bytes */
+    int capacity;
+    int head; /* index of the oldest message in buffer */
+    int count; /* messages in buffer */
+    int senders; /* wait queue of the threads waiting for room, -1 until a thread first waits */
+    int receivers; /* wait queue of the threads waiting for a message, -1 until a thread first waits */
+} uthread_chan_t;
+
+/* histogram buckets of uthread_stats, bucket i counts times in [2^i, 2^(i+1)) ns and the last one also longer times */
+#define UTHREAD_STATS_BUCKETS 32
+
+/* Scheduling statistics of a thread, or of the whole process, filled by uthread_get_stats. Times are in nanoseconds
+ * of CLOCK_MONOTONIC. */
+typedef struct uthread_stats {
+    unsigned long long voluntary_switches; /* the thread gave up the CPU: yield, block, sleep, wait or terminate */
+    unsigned long long involuntary_switches; /* the thread was preempted, by the timer or by a higher priority */
+    unsigned long long run_ns; /* time the thread was RUNNING */
+    unsigned long long wait_ns; /* time the thread was READY, waiting in a run queue to be dispatched */
+    unsigned long long blocked_ns; /* time the thread was blocked, sleeping or waiting for a thread, a lock or I/O */
+    unsigned long long wait_hist[UTHREAD_STATS_BUCKETS]; /* run queue waits, from becoming READY to running */
+    unsigned long long run_hist[UTHREAD_STATS_BUCKETS]; /* how long the thread ran every time it was dispatched */
+} uthread_stats;
+
+/* External interface */
+
+
+/**
+ * @brief initializes the thread library.
+ *
+ * Once this function returns, the main thread (tid == 0) will be set as RUNNING. There is no need to 
+ * provide an entry_point or to create a stack for the main thread - it will be using the "regular" stack and PC.
+ * You may assume that this function is called before any other thread library function, and that it is called
+ * exactly once.
+ * The input to the function is the length of a quantum in micro-seconds.
+ * It is an error to call this function with non-positive quantum_usecs.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_init(int quantum_usecs);
+
+/**
+ * @brief initializes the thread library with the limits in config instead of MAX_THREAD_NUM and STACK_SIZE.
+ *
+ * The thread table and the saved contexts start empty and grow as threads are spawned, so max_threads only bounds
+ * the number of concurrent threads. A zero max_threads or stack_size means MAX_THREAD_NUM or STACK_SIZE.
+ * With tickless set, the timer stops firing every quantum while the running thread is the only runnable one: it is set
+ * to fire once, when the next sleeping thread is due. The quantums that passed meanwhile are still counted by
+ * uthread_get_total_quantums, uthread_get_quantums and uthread_sleep.
+ * With workers > 1 the library starts workers - 1 more kernel threads (pthreads, link with -pthread). Every worker
+ * keeps its READY threads in its own work-stealing deque and has its own timer, a CLOCK_MONOTONIC timer_create timer
+ * that signals only that kernel thread. A thread that becomes READY goes to the deque of the worker that made it
+ * READY, and a worker whose deque is empty steals the oldest thread of another worker, so threads move between the
+ * workers. Threads of different workers run in parallel, and switching threads takes no lock shared by the workers;
+ * the other library calls are serialized by one lock. The deques have no priorities or weights, so UTHREAD_SCHED_FAIR,
+ * uthread_spawn_prio, uthread_set_priority and uthread_set_weight are errors with more than one worker. A worker with
+ * no READY thread to run or steal waits for a signal, and uthread_get_total_quantums counts the quantums of all
+ * workers.
+ * Terminating the main thread ends the process without stopping the other workers first.
+ * With io_uring set, uthread_read, uthread_write and uthread_fsync queue their operations on an io_uring instance.
+ * The operations queued during a quantum are submitted together with one system call when it ends, or at once if no
+ * other thread can run, and their threads become READY as the completions are found on the next switches. If the
+ * kernel has no io_uring or does not allow it, these calls silently use the poll path instead.
+ * clock picks what drives the quantums: the CPU time of the process (UTHREAD_CLOCK_VIRTUAL, the default, or
+ * UTHREAD_CLOCK_PROF, which also counts system time) or wall-clock time (UTHREAD_CLOCK_REAL, or
+ * UTHREAD_CLOCK_MONOTONIC). With a CPU clock, the quantums that pass while every thread waits are counted from the
+ * monotonic clock. The signal of the clock interrupts blocking system calls of the threads like any signal.
+ * With more than one worker the timers always run on CLOCK_MONOTONIC.
+ * The interval timers only expire on kernel ticks, so quantums below a millisecond need UTHREAD_CLOCK_MONOTONIC,
+ * whose timer has nanosecond resolution. Its ticks that are lost to overruns are still counted, see
+ * uthread_get_missed_quantums. timer_slack_ns sets how late the kernel may end the waits of the library, and of the
+ * threads, to batch wakeups; 1 makes them as exact as the kernel allows.
+ * With trace_signal set, that signal (SIGUSR1 or SIGUSR2, say) writes the scheduler trace to
+ * uthreads-<pid>.trace.json in the working directory, like uthread_trace_dump. The library must be built with
+ * -DUTHREADS_TRACE.
+ * It is an error to call this function with non-positive quantum_usecs, negative limits or workers, with tickless,
+ * UTHREAD_SCHED_FAIR, UTHREAD_CLOCK_PROF or UTHREAD_CLOCK_REAL and more than one worker, with a
+ * negative timer_slack_ns, or with a trace_signal that is not a signal, is a timer signal, or that the library was
+ * built without tracing for.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_init_ex(const uthread_config *config);
+
+/**
+ * @brief Creates a new thread, whose entry point is the function entry_point with the signature
+ * void entry_point(void).
+ *
+ * The thread is added to the end of the READY threads list.
+ * The uthread_spawn function should fail if it would cause the number of concurrent threads to exceed the
+ * limit (MAX_THREAD_NUM).
+ * Each thread should be allocated with a stack of size STACK_SIZE bytes.
+ * It is an error to call this function with a null entry_point.
+ *
+ * @return On success, return the ID of the created thread. On failure, return -1.
+*/
+int uthread_spawn(thread_entry_point entry_point);
+
+/**
+ * @brief Creates a new thread like uthread_spawn, with a stack of stack_size bytes.
+ *
+ * A zero stack_size gives the thread the default stack size from uthread_init_ex.
+ * It is an error to call this function with a null entry_point or a negative stack_size.
+ *
+ * @return On success, return the ID of the created thread. On failure, return -1.
+*/
+int uthread_spawn_ex(thread_entry_point entry_point, int stack_size);
+
+/**
+ * @brief Creates a new thread like uthread_spawn, at the given priority.
+ *
+ * Every priority level has its own READY queue. The next thread to run is always taken from the front of the highest
+ * priority (lowest number) level that is not empty, and threads of the same priority share the CPU round-robin.
+ * If the new thread has a higher priority than the calling thread, the caller is moved to the READY queue and the new
+ * thread runs at once.
+ * It is an error to call this function with a null entry_point or a priority outside [0, UTHREAD_PRIORITY_LEVELS),
+ * or with more than one worker.
+ *
+ * @return On success, return the ID of the created thread. On failure, return -1.
+*/
+int uthread_spawn_prio(thread_entry_point entry_point, int priority);
+
+/**
+ * @brief Changes the priority of the thread with ID tid.
+ *
+ * A READY thread moves to the end of the READY queue of its new priority. If this leaves a READY thread with a higher
+ * priority than the RUNNING one, the RUNNING thread is preempted right away.
+ * It is an error if no thread with ID tid exists, if priority is outside [0, UTHREAD_PRIORITY_LEVELS), or if the
+ * library runs more than one worker.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_set_priority(int tid, int priority);
+
+/**
+ * @brief Sets the weight of the thread with ID tid under UTHREAD_SCHED_FAIR.
+ *
+ * Under the fair policy every thread gets CPU time in proportion to its weight: a thread of weight 2048 runs twice
+ * as long as a thread of weight 1024 (UTHREAD_DEFAULT_WEIGHT). Priorities are ignored by this policy, and the weight
+ * is ignored by UTHREAD_SCHED_PRIORITY.
+ * It is an error if no thread with ID tid exists, if weight is outside [1, UTHREAD_MAX_WEIGHT], or if the library
+ * runs more than one worker.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_set_weight(int tid, int weight);
+
+/**
+ * @brief Sets the length of the quantums of the thread with ID tid to slice times quantum_usecs.
+ *
+ * A thread with a longer slice is preempted by the timer less often. Each of its turns still counts as a single
+ * quantum in uthread_get_total_quantums, uthread_get_quantums and uthread_sleep. Under UTHREAD_SCHED_FAIR a turn
+ * costs the thread slice times as much of its share, so a longer slice means fewer and longer turns, not more CPU.
+ * The new slice takes effect the next time the thread is switched in.
+ * It is an error if no thread with ID tid exists or if slice is outside [1, UTHREAD_MAX_SLICE].
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_set_slice(int tid, int slice);
+
+
+/**
+ * @brief Terminates the thread with ID tid and deletes it from all relevant control structures.
+ *
+ * All the resources allocated by the library for this thread should be released. If no thread with ID tid exists it
+ * is considered an error. Terminating the main thread (tid == 0) will result in the termination of the entire
+ * process using exit(0) (after releasing the assigned library memory).
+ *
+ * A thread that another worker is running right now is terminated by that worker at the end of its quantum.
+ *
+ * @return The function returns 0 if the thread was successfully terminated and -1 otherwise. If a thread terminates
+ * itself or the main thread is terminated, the function does not return.
+*/
+int uthread_terminate(int tid);
+
+
+/**
+ * @brief Blocks the thread with ID tid. The thread may be resumed later using uthread_resume.
+ *
+ * If no thread with ID tid exists it is considered as an error. In addition, it is an error to try blocking the
+ * main thread (tid == 0). If a thread blocks itself, a scheduling decision should be made. Blocking a thread in
+ * BLOCKED state has no effect and is not considered an error.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_block(int tid);
+
+
+/**
+ * @brief Resumes a blocked thread with ID tid and moves it to the READY state.
+ *
+ * Resuming a thread in a RUNNING or READY state has no effect and is not considered as an error. If no thread with
+ * ID tid exists it is considered an error.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_resume(int tid);
+
+
+/**
+ * @brief Blocks the RUNNING thread for num_quantums quantums.
+ *
+ * Immediately after the RUNNING thread transitions to the BLOCKED state a scheduling decision should be made.
+ * After the sleeping time is over, the thread should go back to the end of the READY queue.
+ * If the thread which was just RUNNING should also be added to the READY queue, or if multiple threads wake up 
+ * at the same time, the order in which they're added to the end of the READY queue doesn't matter.
+ * The number of quantums refers to the number of times a new quantum starts, regardless of the reason. Specifically,
+ * the quantum of the thread which has made the call to uthread_sleep isn’t counted.
+ * While no thread is READY the process waits in the kernel instead of running a CPU clock, and the quantums that
+ * pass meanwhile are counted from the wall clock.
+ * It is considered an error if the main thread (tid == 0) calls this function.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_sleep(int num_quantums);
+
+
+/**
+ * @brief Blocks the RUNNING thread for usecs micro-seconds of CLOCK_MONOTONIC time.
+ *
+ * Like uthread_sleep, but the deadline does not depend on the quantum length or the clock source. The thread goes
+ * back to the end of the READY queue at the first quantum start after the deadline, or right at the deadline if no
+ * other thread was READY meanwhile.
+ * It is considered an error if the main thread (tid == 0) calls this function, or if usecs is not positive.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_sleep_us(long usecs);
+
+
+/**
+ * @brief Moves the RUNNING thread to the end of the READY queue and switches to the next READY thread right away.
+ *
+ * The switch does not wait for the quantum to expire and does not go through the timer signal. The thread that is
+ * switched to starts a new quantum (counted like any other quantum start) and runs for the rest of the current timer
+ * interval. If no other thread is READY the function returns at once and the caller keeps its quantum.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_yield();
+
+
+/**
+ * @brief Returns the thread ID of the calling thread.
+ *
+ * @return The ID of the calling thread.
+*/
+int uthread_get_tid();
+
+
+/**
+ * @brief Returns the total number of quantums since the library was initialized, including the current quantum.
+ *
+ * Right after the call to uthread_init, the value should be 1.
+ * Each time a new quantum starts, regardless of the reason, this number should be increased by 1.
+ *
+ * @return The total number of quantums.
+*/
+int uthread_get_total_quantums();
+
+
+/**
+ * @brief Returns the number of quantums whose timer tick was missed, because the timer expired again before its
+ * signal was handled (an overrun of a UTHREAD_CLOCK_MONOTONIC timer) or while a preemption was already pending.
+ *
+ * The missed quantums are counted by uthread_get_total_quantums and uthread_sleep as if they had started.
+ *
+ * @return The number of missed quantums.
+*/
+int uthread_get_missed_quantums();
+
+
+/**
+ * @brief Returns the number of quantums the thread with ID tid was in RUNNING state.
+ *
+ * On the first time a thread runs, the function should return 1. Every additional quantum that the thread starts should
+ * increase this value by 1 (so if the thread with ID tid is in RUNNING state when this function is called, include
+ * also the current quantum). If no thread with ID tid exists it is considered an error.
+ *
+ * @return On success, return the number of quantums of the thread with ID tid. On failure, return -1.
+*/
+int uthread_get_quantums(int tid);
+
+
+/**
+ * @brief Fills stats with the scheduling statistics of the thread with ID tid, up to the time of the call.
+ *
+ * Every thread counts its own context switches and the time it spent RUNNING, READY and blocked, with histograms of
+ * its run queue waits and of its turns on the CPU. The counters are kept from the moment the thread is spawned, they
+ * are recorded at every switch without locks or allocation. A ZOMBIE thread keeps its statistics until it is joined.
+ * It is an error to call this function with a null stats or with a tid that does not exist.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_get_stats(int tid, uthread_stats *stats);
+
+
+/**
+ * @brief Fills stats with the scheduling statistics of the whole process: the sum over the threads that exist now and
+ * all the threads that terminated since the library was initialized.
+ *
+ * It is an error to call this function with a null stats.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_get_process_stats(uthread_stats *stats);
+
+
+/**
+ * @brief Writes the scheduler trace to the file at path.
+ *
+ * A library built with -DUTHREADS_TRACE records every status change of every thread (spawn, schedule, preempt, yield,
+ * block, resume, sleep, wake, unpark and terminate) with a time stamp in a fixed ring, which keeps the most recent
+ * events. In UTHREAD_TRACE_JSON format every thread is a row whose slices show when it was RUNNING.
+ * The dump is lock-free: the threads keep running and recording while it is written. The same dump is made by the
+ * signal set in uthread_config::trace_signal.
+ * It is an error to call this function with a null path, an unknown format, while another dump runs, or in a library
+ * built without tracing.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_trace_dump(const char *path, int format);
+
+
+/**
+ * @brief Creates a new joinable thread that runs start_routine(arg).
+ *
+ * The thread is added to the READY queue like a thread made by uthread_spawn, with the default stack size and
+ * priority. When start_routine returns, or the thread calls uthread_exit or is terminated, its stack is released but
+ * its ID stays in use until another thread collects the return value with uthread_join, or it is detached.
+ * Threads made by uthread_spawn are detached from the start.
+ * It is an error to call this function with a null start_routine.
+ *
+ * @return On success, return the ID of the created thread. On failure, return -1.
+*/
+int uthread_create(uthread_start_routine start_routine, void *arg);
+
+
+/**
+ * @brief Waits until the thread with ID tid terminates and releases its ID.
+ *
+ * If the thread already terminated the function returns at once. Otherwise the calling thread is BLOCKED and a
+ * scheduling decision is made; it moves to the READY queue when the thread terminates. If retval is not null, the
+ * value the thread returned or passed to uthread_exit (null if it was terminated) is stored in it.
+ * It is an error if no thread with ID tid exists, if it is detached, if it is the calling thread, or if another
+ * thread already waits for it.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_join(int tid, void **retval);
+
+
+/**
+ * @brief Detaches the thread with ID tid: its ID is released as soon as it terminates, and it can not be joined.
+ *
+ * Detaching a thread that already terminated releases its ID right away. Detaching a detached thread has no effect.
+ * It is an error if no thread with ID tid exists or if another thread waits for it.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_detach(int tid);
+
+
+/**
+ * @brief Terminates the calling thread with the return value retval, which a thread joining it receives.
+ *
+ * Called by the main thread it ends the process like uthread_terminate(0). The function does not return.
+*/
+void uthread_exit(void *retval);
+
+
+/**
+ * @brief Initializes mutex as unlocked.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_mutex_init(uthread_mutex_t *mutex);
+
+
+/**
+ * @brief Releases the library resources of mutex. It is an error to destroy a locked mutex.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_mutex_destroy(uthread_mutex_t *mutex);
+
+
+/**
+ * @brief Locks mutex, waiting until it is unlocked if another thread holds it.
+ *
+ * Locking a mutex that no thread holds takes a single atomic instruction, with no signal masking and no system call.
+ * Otherwise the calling thread is BLOCKED and a scheduling decision is made. When the holder unlocks the mutex it is
+ * handed directly to the thread that waited the longest, which moves to the end of the READY queue.
+ * A thread waiting for a mutex is not released by uthread_resume. It is an error to lock a mutex the calling thread
+ * already holds, or to wait when no other thread is READY or sleeping.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_mutex_lock(uthread_mutex_t *mutex);
+
+
+/**
+ * @brief Locks mutex if no thread holds it, without waiting.
+ *
+ * @return If the mutex was locked by the call, return 0. Otherwise return -1.
+*/
+int uthread_mutex_trylock(uthread_mutex_t *mutex);
+
+
+/**
+ * @brief Unlocks mutex, handing it to the next waiting thread if there is one.
+ *
+ * It is an error to unlock a mutex that the calling thread does not hold.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_mutex_unlock(uthread_mutex_t *mutex);
+
+
+/**
+ * @brief Initializes cond with no waiting threads.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_cond_init(uthread_cond_t *cond);
+
+
+/**
+ * @brief Releases the library resources of cond. It is an error to destroy a condition variable threads wait on.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_cond_destroy(uthread_cond_t *cond);
+
+
+/**
+ * @brief Unlocks mutex and waits on cond, then locks mutex again before returning.
+ *
+ * The calling thread must hold mutex. Unlocking and starting to wait happen together, so a signal sent after the
+ * caller unlocked the mutex is not lost. As with any condition variable, the caller should check its condition
+ * again after the call returns.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_cond_wait(uthread_cond_t *cond, uthread_mutex_t *mutex);
+
+
+/**
+ * @brief Moves the thread that waited the longest on cond to the end of the READY queue.
+ *
+ * Signaling a condition variable no thread waits on has no effect.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_cond_signal(uthread_cond_t *cond);
+
+
+/**
+ * @brief Moves all the threads waiting on cond to the READY queue.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_cond_broadcast(uthread_cond_t *cond);
+
+
+/**
+ * @brief Initializes chan as an empty channel for up to capacity messages of elem_size bytes.
+ *
+ * A channel with capacity 0 holds no messages: every send waits until a thread receives the message.
+ * It is an error to call this function with a null chan, a negative capacity or an elem_size of 0.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_chan_init(uthread_chan_t *chan, int capacity, size_t elem_size);
+
+
+/**
+ * @brief Releases the buffer and the library resources of chan. It is an error to destroy a channel threads wait on.
+ *
+ * The messages left in the channel are dropped.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_chan_destroy(uthread_chan_t *chan);
+
+
+/**
+ * @brief Sends the elem_size bytes at msg on chan, waiting for room if the channel is full.
+ *
+ * If a thread waits to receive, the message is copied straight into its destination and the calling worker switches
+ * to it at once, without a pass through the READY queue; the calling thread moves to the end of the READY queue, as
+ * in uthread_yield. Otherwise the message is copied into the channel. If the channel is full, the calling thread is
+ * BLOCKED and a scheduling decision is made, until a receiver takes its message. Messages are received in the order
+ * they were sent, and waiting senders in the order they started to wait.
+ * A thread waiting on a channel is not released by uthread_resume. It is an error to call this function with null
+ * pointers, or to wait when no other thread is READY or sleeping.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_chan_send(uthread_chan_t *chan, const void *msg);
+
+
+/**
+ * @brief Receives the oldest message of chan into the elem_size bytes at msg, waiting for one if the channel is empty.
+ *
+ * Taking a message makes room for the sender that waited the longest, whose message is moved into the channel and
+ * which moves to the end of the READY queue. If the channel is empty, the calling thread is BLOCKED and a scheduling
+ * decision is made, until a sender hands it a message.
+ * A thread waiting on a channel is not released by uthread_resume. It is an error to call this function with null
+ * pointers, or to wait when no other thread is READY or sleeping.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_chan_recv(uthread_chan_t *chan, void *msg);
+
+
+/**
+ * @brief Reads up to count bytes from fd like read(2), blocking only the calling thread.
+ *
+ * fd is switched to non-blocking mode. If no data is available the calling thread is BLOCKED and a scheduling
+ * decision is made; it moves to the READY queue once fd is readable. The library checks the file descriptors of the
+ * waiting threads with epoll on every switch, and waits for them in the kernel when no other thread can run.
+ * A thread waiting for I/O is not released by uthread_resume.
+ * With the io_uring engine (see uthread_init_ex) the read is queued on the ring instead, and fd is left as it is.
+ * A non-blocking fd with no data still takes the poll path.
+ *
+ * @return The number of bytes read, 0 at end of file. On failure, return -1 and set errno.
+*/
+ssize_t uthread_read(int fd, void *buf, size_t count);
+
+
+/**
+ * @brief Writes up to count bytes to fd like write(2), blocking only the calling thread.
+ *
+ * fd is switched to non-blocking mode. If fd can not take any data the calling thread is BLOCKED until it is
+ * writable, as in uthread_read. Like write(2) it may write fewer than count bytes. With the io_uring engine the
+ * write is queued on the ring, as in uthread_read.
+ *
+ * @return The number of bytes written. On failure, return -1 and set errno.
+*/
+ssize_t uthread_write(int fd, const void *buf, size_t count);
+
+
+/**
+ * @brief Accepts a connection on the listening socket fd like accept(2), blocking only the calling thread.
+ *
+ * fd is switched to non-blocking mode, and the calling thread is BLOCKED until a connection arrives, as in
+ * uthread_read. The new socket is left in blocking mode; uthread_read and uthread_write switch it when they use it.
+ *
+ * @return The file descriptor of the accepted socket. On failure, return -1 and set errno.
+*/
+int uthread_accept(int fd, struct sockaddr *addr, socklen_t *addrlen);
+
+
+/**
+ * @brief Connects the socket fd to addr like connect(2), blocking only the calling thread.
+ *
+ * fd is switched to non-blocking mode, and the calling thread is BLOCKED until the connection is established or
+ * fails, as in uthread_read.
+ *
+ * @return On success, return 0. On failure, return -1 and set errno.
+*/
+int uthread_connect(int fd, const struct sockaddr *addr, socklen_t addrlen);
+
+
+/**
+ * @brief Flushes fd to its storage device like fsync(2), blocking only the calling thread.
+ *
+ * With the io_uring engine the calling thread is BLOCKED until the flush completes. Without it the whole process
+ * waits in fsync(2), since a regular file can not be polled.
+ *
+ * @return On success, return 0. On failure, return -1 and set errno.
+*/
+int uthread_fsync(int fd);
+
+
+#endif
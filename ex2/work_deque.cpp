@@ -0,0 +1,76 @@
+#include "work_deque.h"
+
+WorkDeque::WorkDeque(int capacity) : size(1)
+{
+    while(size < capacity){
+        size *= 2;
+    }
+    slots = new Thread*[size]();
+}
+
+WorkDeque::~WorkDeque()
+{
+    delete[] slots;
+}
+
+/**
+ * the slot is written before bottom is published with a release fence, so a stealer that sees the new bottom also
+ * sees the thread in it
+ * @param thread
+ */
+void WorkDeque::push(Thread* thread)
+{
+    long b = __atomic_load_n(&bottom, __ATOMIC_RELAXED);
+    __atomic_store_n(&slots[b & (size - 1)], thread, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&bottom, b + 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * takes the bottom slot first and then checks top, so only a race for the last thread needs a compare-and-swap
+ * @return the thread pushed last, nullptr if the deque is empty
+ */
+Thread* WorkDeque::pop()
+{
+    long b = __atomic_load_n(&bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long t = __atomic_load_n(&top, __ATOMIC_RELAXED);
+    if(t > b){
+        __atomic_store_n(&bottom, b + 1, __ATOMIC_RELAXED);
+        return nullptr;
+    }
+    Thread* thread = __atomic_load_n(&slots[b & (size - 1)], __ATOMIC_RELAXED);
+    if(t == b){
+        if(!__atomic_compare_exchange_n(&top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)){
+            thread = nullptr; // a stealer got it
+        }
+        __atomic_store_n(&bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return thread;
+}
+
+/**
+ * retries when another stealer or the owner wins the race for the top slot, so it only fails on an empty deque
+ * @return the thread pushed first, nullptr if the deque is empty
+ */
+Thread* WorkDeque::steal()
+{
+    while(true){
+        long t = __atomic_load_n(&top, __ATOMIC_ACQUIRE);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        long b = __atomic_load_n(&bottom, __ATOMIC_ACQUIRE);
+        if(t >= b){
+            return nullptr;
+        }
+        Thread* thread = __atomic_load_n(&slots[t & (size - 1)], __ATOMIC_RELAXED);
+        if(__atomic_compare_exchange_n(&top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)){
+            return thread;
+        }
+    }
+}
+
+bool WorkDeque::empty() const
+{
+    return __atomic_load_n(&top, __ATOMIC_RELAXED) >= __atomic_load_n(&bottom, __ATOMIC_RELAXED);
+}
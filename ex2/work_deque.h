@@ -0,0 +1,54 @@
+#ifndef UTHREADS_WORK_DEQUE_H
+#define UTHREADS_WORK_DEQUE_H
+
+struct Thread;
+
+/**
+ * Chase-Lev work-stealing deque of threads (the C11 version of Le, Pop, Cohen and Zappa Nardelli).
+ * only the worker that owns the deque pushes and pops, at the bottom, with plain loads and stores and a fence on pop;
+ * any other worker steals from the top with a compare-and-swap. a thread is in at most one deque at a time, so the
+ * ring is sized for every thread when the deque is built and never grows: pushing happens on the preemption path,
+ * inside the timer signal handler, where allocating is not safe.
+ */
+class WorkDeque{
+    long top = 0; // next slot a stealer takes
+    char pad[64 - sizeof(long)]; // keeps top and bottom on different cache lines
+    long bottom = 0; // next slot the owner pushes to
+    long size; // a power of two, slots are picked with index & (size - 1)
+    Thread** slots;
+public :
+    /**
+     * @param capacity the most threads the deque can hold, rounded up to a power of two
+     */
+    explicit WorkDeque(int capacity);
+
+    WorkDeque(const WorkDeque&) = delete;
+
+    WorkDeque& operator=(const WorkDeque&) = delete;
+
+    ~WorkDeque();
+
+    /**
+     * may only be called by the owner
+     */
+    void push(Thread* thread);
+
+    /**
+     * may only be called by the owner
+     * @return the thread pushed last, nullptr if the deque is empty
+     */
+    Thread* pop();
+
+    /**
+     * may be called by any worker, including the owner
+     * @return the thread pushed first, nullptr if the deque is empty
+     */
+    Thread* steal();
+
+    /**
+     * @return true if the deque looked empty, the answer may be stale by the time it is used
+     */
+    bool empty() const;
+};
+
+#endif //UTHREADS_WORK_DEQUE_H